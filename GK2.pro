@@ -3,7 +3,7 @@ INCLUDEPATH += ./src ./include
 SOURCES += ./src/*.cpp
 HEADERS += ./include/*.hpp
 
-QT += core gui widgets
+QT += core gui widgets concurrent
 
 RESOURCES     = resources.qrc
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSize>
+#include <QString>
+
+#include <functional>
+#include <vector>
+
+#define BENCHMARK_RUNS 5
+#define BENCHMARK_MAX_VERTICES 100000 // vertices of largest polygon of every project
+#define BENCHMARK_IMAGE_SIZE 4096
+#define BENCHMARK_VIEW_SIZE QSize(1920, 1080)
+#define BENCHMARK_QUERIES 10000 // hit-test points per run
+#define BENCHMARK_SEED 1 // of shapes checked by Rasterizer::verify
+
+class MainWindow;
+class ShapeStore;
+struct Shape;
+
+struct BenchmarkOptions
+{
+  std::vector<int> shapeCounts;
+  int maxVertices;
+  int runs;
+  int imageSize;
+
+  BenchmarkOptions()
+    : shapeCounts{1000, 10000, 100000, 1000000}, maxVertices{BENCHMARK_MAX_VERTICES},
+      runs{BENCHMARK_RUNS}, imageSize{BENCHMARK_IMAGE_SIZE}
+  {}
+};
+
+/*
+ * Times project I/O, painting and hit-testing on synthetic projects.
+ * Every case runs options.runs times, minimum and median are reported.
+ * Needs QApplication, painting goes through offscreen RenderArea.
+ */
+class Benchmark
+{
+  public:
+    Benchmark(const BenchmarkOptions &options);
+
+    // false when some case could not run (files, image)
+    bool run();
+    QJsonDocument results() const;
+
+    // count circles, rectangles and polygons, first one is polygon of maxVertices vertices
+    static void generate(ShapeStore &store, std::vector<Shape*> &shapes, int count, int maxVertices,
+                         QSize imageSize, quint32 seed);
+
+  private:
+    bool runProject(int count, const QString &dir);
+    void measure(const QString &name, int shapes, qint64 vertices, qint64 bytes,
+                 const std::function<void()> &body, const std::function<void()> &setup = nullptr);
+    bool waitForImage(MainWindow &window);
+
+    BenchmarkOptions options;
+    QJsonArray cases;
+    bool rasterizerExact{false};
+};
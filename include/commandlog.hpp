@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QByteArray>
+#include <QPoint>
+
+#include <deque>
+#include <vector>
+
+#include "shape.hpp"
+
+#define UNDO_BUDGET (32*1024*1024) // bytes kept by undo and redo history
+
+enum class CommandType
+{
+  Create, Delete, MoveOrigin, MoveVertex, Recolor
+};
+
+/*
+ * Undoable edit storing only the change. Shapes are referenced by store
+ * id, which is kept when deleted shape is recreated. Whole shape record
+ * (v2 layout) is kept only where shape has to be recreated.
+ */
+struct Command
+{
+  CommandType type;
+  quint32 shapeId;
+  int row{-1};          // create, delete: position in drawing order
+  int vertex{-1};       // move vertex
+  QPoint delta;         // change of position (move origin) or vertex (move vertex)
+  QPoint verticesDelta; // move origin: change of all vertices
+  QPoint sizeDelta;     // move vertex: size change of non-polygon shapes
+  Color before{0,0,0};  // recolor
+  Color after{0,0,0};
+  QByteArray record;    // create, delete
+  bool open{false};     // drag in progress, following moves are merged
+
+  Command(CommandType t, quint32 id) : type{t}, shapeId{id} {}
+
+  inline size_t bytes() const { return sizeof(Command) + (size_t)record.size(); }
+  // merges next move of the same drag
+  bool merge(const Command &next);
+};
+
+/*
+ * Undo and redo stacks limited by memory budget, oldest undo steps are
+ * dropped first. Continuous drags end up as one command.
+ */
+class CommandLog
+{
+  public:
+    CommandLog(size_t budget = UNDO_BUDGET) : budget{budget} {}
+
+    // new edit, redo history is discarded
+    void push(Command command);
+    // ends drag, next move starts new command
+    void seal();
+    void clear();
+    void setBudget(size_t bytes);
+
+    inline bool canUndo() const { return !undoStack.empty(); }
+    inline bool canRedo() const { return !redoStack.empty(); }
+    inline size_t size() const { return used; }
+
+    // command is taken out while it is applied and handed back after
+    Command takeUndo();
+    void undone(Command command);
+    Command takeRedo();
+    void redone(Command command);
+
+  private:
+    void trim();
+
+    std::deque<Command> undoStack;
+    std::vector<Command> redoStack;
+    size_t budget;
+    size_t used{0};
+};
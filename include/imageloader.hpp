@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/*
+ * Decodes images on worker thread. Preview scaled to screen size is
+ * decoded first (QImageReader scales while decoding), full resolution
+ * image with its pyramid levels follows. Running decode is not waited
+ * for, it stops at next stage once cancelled or loader is destroyed.
+ */
+class ImageLoader : public QObject
+{
+  Q_OBJECT
+
+  public:
+    ImageLoader(QObject *parent = nullptr);
+    ~ImageLoader();
+
+    // returns false when file is not a readable image, decoding is asynchronous
+    bool load(const QString &fileName, QSize previewSize);
+    void cancel();
+
+  signals:
+    void progress(int percent, const QString &message);
+    void previewLoaded(QImage preview, QSize fullSize);
+    void imageLoaded(QImage image, std::vector<QImage> levels);
+    void failed(const QString &fileName);
+
+  private:
+    // shared with decode tasks which may outlive loader
+    std::shared_ptr<std::atomic<int>> generation;
+};
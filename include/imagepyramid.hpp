@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QCache>
+#include <QImage>
+#include <QPainter>
+
+#include <vector>
+
+#include "viewtransform.hpp"
+
+#define TILE_SIZE 256
+#define TILE_CACHE_BUDGET (64*1024) // kilobytes of tiles scaled on demand
+#define PYRAMID_RESIDENT_PIXELS (4*1024*1024) // levels up to this size are kept whole
+
+/*
+ * Mip-mapped representation of an image. Level 0 is the source image,
+ * every next level is downscaled by two. Only levels of at most
+ * PYRAMID_RESIDENT_PIXELS are kept decoded, larger ones are split into
+ * TILE_SIZE x TILE_SIZE tiles scaled from the source on demand and kept
+ * in a LRU cache bounded by TILE_CACHE_BUDGET. Memory on top of source
+ * image is therefore bounded whatever its size.
+ */
+class ImagePyramid
+{
+  public:
+    ImagePyramid();
+
+    // resident levels can be built on worker thread, tiles only on GUI thread
+    static std::vector<QImage> buildLevels(const QImage &image);
+
+    // levels may come from preview smaller than image size
+    void setLevels(std::vector<QImage> levels, QSize imageSize);
+    inline void build(const QImage &image) { setLevels(buildLevels(image), image.size()); }
+    void clear();
+
+    inline bool isNull() const { return levels.empty(); }
+    inline int levelCount() const { return (int)levels.size(); }
+    inline QSize size() const { return imageSize; }
+
+    // coarsest level which still has at least as many pixels as the screen
+    int levelForScale(double scale) const;
+
+    // draws part of image visible in widgetRect mapped through view
+    void draw(QPainter &painter, const ViewTransform &view, const QRect &widgetRect);
+
+    inline void setBudget(int kilobytes) { tiles.setMaxCost(kilobytes); }
+
+  private:
+    // null for levels which are only tiled
+    std::vector<QImage> levels;
+    std::vector<QSize> levelSizes;
+    QSize imageSize;
+    QCache<quint64, QImage> tiles;
+
+    static QSize halved(QSize size);
+    QImage tile(int level, int tx, int ty);
+};
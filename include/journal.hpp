@@ -0,0 +1,103 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+#define JOURNAL_SUFFIX ".journal"
+#define JOURNAL_VERSION 1
+#define JOURNAL_FLUSH_DELAY 1000 // ms from first change to batch write
+#define JOURNAL_COMPACT_SIZE (8*1024*1024) // appended bytes that trigger compaction
+#define JOURNAL_COMPACT_INTERVAL (5*60*1000) // ms between compactions of changed project
+
+class RenderArea;
+class ShapeStore;
+struct ProjectSnapshot;
+struct Shape;
+
+/*
+ * Append-only autosave journal kept beside project file.
+ *
+ * header: "GK2J" u8[version] u32le[project size low] u32le[project size high] u16le[project checksum]
+ *         u32le[shapes count] u32le[id]... (ids of shapes in project file order)
+ * record: u8[op] u32le[id] u32le[row] u32le[payload size] payload u16le[checksum]
+ *
+ * Create and modify records carry shape in RenderArea::serializeShape layout,
+ * delete records have no payload. Changes are collected on GUI thread and
+ * written in batches by single writer thread, so autosave cost depends on
+ * number of changed shapes only. From time to time snapshot of whole project
+ * is written into project file and journal starts again (compaction). Header
+ * ties journal to exact project file contents, torn last record is ignored.
+ */
+class Journal : public QObject
+{
+  Q_OBJECT
+
+  public:
+    Journal(RenderArea *area, const QString &projectFile, QObject *parent = nullptr);
+
+    // writes pending changes and stops following area, journal deletes itself
+    // once its queued writes are done, so closing never waits for them
+    void close();
+
+    // compactNow writes project file first (save, journal was replayed)
+    void start(bool compactNow);
+    void flush();
+    // project is written in background, editing can go on
+    void compact();
+    // drops unwritten changes and removes journal file, later changes are ignored
+    void discard();
+
+    inline const QString &getProjectFile() const { return projectFile; }
+
+    static QString fileNameFor(const QString &projectFile);
+    // blocks until writes of all journals are done (exit, reopening same project)
+    static void waitForWrites();
+    // applies journal to shapes read from project file, returns number of
+    // applied records or -1 when journal does not belong to the file
+    static int replay(const QString &projectFile, ShapeStore &store, std::vector<Shape*> &shapes);
+
+  signals:
+    // emitted from writer thread
+    void saved(const QString &projectFile, qint64 bytes, int shapes, double seconds);
+    void saveFailed(const QString &projectFile);
+    void failed(const QString &message);
+
+  private:
+    enum Op : uint8_t
+    {
+      Create = 1, Modify = 2, Delete = 3
+    };
+
+    void shapeInserted(int row);
+    void shapeAboutToBeRemoved(int row);
+    void shapeModified(Shape *shape);
+    void schedule();
+    void restart(std::shared_ptr<const ProjectSnapshot> snapshot);
+
+    static void appendRecord(QByteArray &out, Op op, quint32 id, quint32 row, const Shape *shape);
+
+    RenderArea *area;
+    QString projectFile;
+    QString journalFile;
+
+    // create and delete records in order of changes
+    QByteArray pending;
+    // shapes written at flush with their state at that time
+    QSet<quint32> modified;
+    qint64 journalSize{0};
+    bool changedSinceCompaction{false};
+
+    QTimer flushTimer;
+    QTimer compactTimer;
+
+    // one thread shared by all journals keeps writes in order, also of
+    // journal closed meanwhile and new one of the same project
+    static QThreadPool *writer();
+};
@@ -1,16 +1,18 @@
 #pragma once
 
 #include <QMainWindow>
-#include <QListWidgetItem>
+#include <QModelIndex>
 
 class QAction;
 class QActionGroup;
 class QLabel;
 class QMenu;
-class QListWidget;
+class QListView;
 class QHBoxLayout;
 
 class RenderArea;
+class Journal;
+class ShapeListModel;
 struct Shape;
 
 enum class ToolType;
@@ -26,28 +28,25 @@ struct ButtonArgument
 
 typedef struct ButtonArgument BARG;
 
-class ShapeItem : public QListWidgetItem
-{
-  public:
-  ShapeItem(Shape *shape);
-
-  Shape *shape{nullptr};
-
-};
-
 class MainWindow : public QMainWindow
 {
   Q_OBJECT
 
   public:
     MainWindow();
+    ~MainWindow();
     void createMenus();
 
     // menu bar
     void newProject();
+    void undo();
+    void redo();
     void loadProject();
     void saveProject();
     void loadImage();
+    void setEyedropperSize();
+    void fitToWindow();
+    void toggleLatencyOverlay();
     void exit();
     void about();
 
@@ -55,17 +54,35 @@ class MainWindow : public QMainWindow
     void selected(BARG arg);
 
     public slots:
-      void shapeSelected(QListWidgetItem *item);
+      void shapeSelected(const QModelIndex &index);
       void showContextMenu(const QPoint &pos);
       void deleteItem();
+      void imageProgress(int percent, const QString &message);
+      void imageFailed(const QString &fileName);
+      void colorPicked(const QColor &color);
+      void projectSaved(const QString &fileName, qint64 bytes, int shapes, double seconds);
+      void projectSaveFailed(const QString &fileName);
 
-    void addedShape(Shape *shape);
+    void pickedShape(Shape *shape);
     bool loadProjectFile(QString fileName);
 
     inline RenderArea *getArea() { return area; }
 
   private:
+    void connectArea();
+    void updateHistoryActions();
+    // journal follows project file, untitled projects have none
+    void startJournal(const QString &fileName, bool compactNow);
+    void stopJournal();
+
     RenderArea *area;
-    QListWidget *shapesList;
+    Journal *journal;
+    QAction *undoAction;
+    QAction *redoAction;
+    QAction *latencyAction;
+    // kept here so it survives new projects
+    int eyedropperSize;
+    ShapeListModel *shapesModel;
+    QListView *shapesList;
     QHBoxLayout *allLayout;
 };
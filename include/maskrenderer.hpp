@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include <vector>
+
+#define INSTANCE_MASK_MAX 0xffff // shapes of project rendered as instances
+
+struct Shape;
+
+enum class MaskMode
+{
+  Label,    // 8-bit, shape type + 1 per pixel
+  Instance  // 16-bit, shape index + 1 per pixel
+};
+
+/*
+ * Rasterizes project shapes into full resolution masks without GUI.
+ * Shapes are filled in file order, later shapes overwrite earlier ones,
+ * 0 means background.
+ */
+class MaskRenderer
+{
+  public:
+    // shape index + 1 per pixel, row after row, at most INSTANCE_MASK_MAX shapes
+    static std::vector<quint16> renderInstances(const std::vector<Shape*> &shapes, QSize size);
+    // shape type + 1 per pixel, rasterized straight into 8-bit image
+    static QImage renderLabels(const std::vector<Shape*> &shapes, QSize size);
+
+    // loads project, renders its mask and writes it to outputDir
+    static bool renderProject(const QString &projectFile, const QString &outputDir, MaskMode mode, QString &error);
+
+    // renders projects on jobs threads with bounded queue, returns number of failed projects
+    static int renderAll(const QStringList &projectFiles, const QString &outputDir, MaskMode mode, int jobs);
+};
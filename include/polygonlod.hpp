@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QHash>
+#include <QPoint>
+
+#include <vector>
+
+#include "shape.hpp"
+
+#define LOD_MIN_VERTICES 256 // polygons with fewer vertices are always drawn whole
+#define LOD_TOLERANCE 0.5 // widget pixels a simplified outline may move per level
+#define LOD_MAX_LEVEL 24
+
+/*
+ * Simplified outlines of large polygons. Level k drops vertices closer than
+ * 2^k image pixels to previously kept vertex (radial distance decimation,
+ * O(n)), so point count drawn follows outline length on screen instead of
+ * vertex count. Levels are built lazily from the next finer level when they
+ * are first drawn and dropped when shape revision changes.
+ */
+class PolygonLod
+{
+  public:
+    // vertices to draw shape with at scale widget pixels per image pixel,
+    // missing level is built (GUI thread only)
+    const QPoint *points(const Shape *shape, double scale, int &count);
+    // level built before by points() or whole outline, safe from painting threads
+    const QPoint *cached(const Shape *shape, double scale, int &count) const;
+
+    // -1 when outline is drawn whole
+    static int levelFor(double scale);
+
+    inline void remove(quint32 id) { entries.remove(id); }
+    inline void clear() { entries.clear(); }
+
+    static void decimate(const QPoint *points, int count, int tolerance, std::vector<QPoint> &result);
+
+  private:
+    struct Entry
+    {
+      quint32 revision;
+      // level k, empty until used
+      std::vector<std::vector<QPoint>> levels;
+    };
+    QHash<quint32, Entry> entries;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <vector>
+
+struct Shape;
+class ShapeStore;
+
+/*
+ * Reads GK2 project files (v1 and v2, see ProjectWriter). File is memory-mapped (or read when it cannot
+ * be mapped) and every record is validated against remaining bytes before
+ * it is parsed, so truncated or corrupt files are rejected.
+ */
+class ProjectReader
+{
+  public:
+    ProjectReader(const QString &fileName);
+    ~ProjectReader();
+
+    // maps file and parses header
+    bool open();
+    // parses all shape records into store, nothing is returned when any of them is corrupt
+    bool readShapes(ShapeStore &store, std::vector<Shape*> &shapes);
+
+    inline int formatVersion() const { return version; }
+    inline const QString &imageName() const { return image; }
+    inline const QString &errorString() const { return error; }
+
+  private:
+    bool openV2();
+
+    QFile file;
+    const uchar *data{nullptr};
+    size_t size{0};
+    // used only when file cannot be mapped
+    QByteArray buffer;
+
+    int version{0};
+    size_t shapesOffset{0};
+    size_t shapesCount{0};
+    QString image;
+    QString error;
+};
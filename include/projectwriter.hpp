@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "shapestore.hpp"
+
+#define PROJECT_VERSION 2 // version written by default
+
+class QFileDevice;
+
+/*
+ * Copy of project taken on GUI thread so it can be encoded elsewhere while
+ * editing goes on. Shapes keep their ids, vertices are copied into arena of
+ * own store (no allocation per shape, no encoding).
+ */
+struct ProjectSnapshot
+{
+  std::string imageName;
+  ShapeStore store;
+  std::vector<Shape*> shapes;
+};
+
+/*
+ * Writes GK2 project files. Whole project is encoded into one buffer
+ * whose size is computed up front, so there is no allocation per shape.
+ *
+ * v1: "GK2" u8[name size] name\0 records (RenderArea::serializeShape)
+ * v2: "GK2" u8[0] u8[version] u32le[name size] name u32le[shapes count] records (RenderArea::serializeShapeV2)
+ */
+class ProjectWriter
+{
+  public:
+    static size_t encodedSize(const std::string &imageName, const std::vector<Shape*> &shapes,
+                              int version = PROJECT_VERSION);
+    static QByteArray encode(const std::string &imageName, const std::vector<Shape*> &shapes,
+                             int version = PROJECT_VERSION);
+
+    static std::shared_ptr<const ProjectSnapshot> snapshot(const std::string &imageName,
+                                                           const std::vector<Shape*> &shapes);
+
+    // replaces file atomically (QSaveFile), data is on disk before rename
+    static bool save(const QString &fileName, const QByteArray &data);
+    // flushes written data to disk (fsync)
+    static bool sync(QFileDevice &file);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QPoint>
+#include <QRect>
+
+#include <cstdint>
+#include <vector>
+
+struct Shape;
+
+struct Span
+{
+  int y;
+  int x0; // first covered pixel
+  int x1; // one past last covered pixel
+};
+
+/*
+ * Scanline rasterizer with active edge table. Pixel is covered when its
+ * center lies inside shape (even-odd rule for polygons). Edge crossings
+ * are computed with integer arithmetic only, so masks are bit-exact on
+ * every platform. Spans are filled with AVX2/SSE2 stores when available.
+ * Both claims are checked by verify(), which --benchmark runs first.
+ */
+class Rasterizer
+{
+  public:
+    // spans are appended row by row, clipped to clip rectangle
+    static void polygonSpans(const QPoint *points, int count, const QRect &clip, std::vector<Span> &spans);
+    static void ellipseSpans(const QRect &rect, const QRect &clip, std::vector<Span> &spans);
+    static void rectSpans(const QRect &rect, const QRect &clip, std::vector<Span> &spans);
+    static void shapeSpans(const Shape *shape, const QRect &clip, std::vector<Span> &spans);
+
+    static void fillSpan(uint8_t *row, int count, uint8_t value);
+    static void fillSpan(uint16_t *row, int count, uint16_t value);
+
+    // fills spans in row-major buffer whose pixel (0,0) is at origin
+    static void fill(uint8_t *buffer, int stride, QPoint origin, const std::vector<Span> &spans, uint8_t value);
+    static void fill(uint16_t *buffer, int stride, QPoint origin, const std::vector<Span> &spans, uint16_t value);
+
+    // compares SIMD fills with scalar ones and spans of random shapes with
+    // exact per-pixel reference, first mismatch is logged
+    static bool verify(quint32 seed);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+
+#include <array>
+#include <cstdint>
+
+#define STATS_CHUNK_PIXELS (256*1024) // pixels reduced by one thread
+
+struct Shape;
+
+/*
+ * Color statistics of image pixels covered by shape. Mean and median are
+ * derived from per-channel histograms, so one pass over pixels is enough.
+ */
+struct RegionStats
+{
+  quint64 count{0};
+  QRect bounds; // image-space box of covered pixels
+  double mean[3]{0.0, 0.0, 0.0};
+  int median[3]{0, 0, 0};
+  std::array<quint32, 256> histogram[3];
+
+  RegionStats()
+  {
+    for (auto &h : histogram)
+      h.fill(0);
+  }
+
+  inline bool isEmpty() const { return count == 0; }
+
+  /*
+   * image may be preview smaller than imageSize (full resolution size
+   * defining image space), then covered pixels are sampled from it.
+   * Large shapes are reduced on several threads.
+   */
+  static RegionStats compute(const QImage &image, QSize imageSize, const Shape &shape);
+};
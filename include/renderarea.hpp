@@ -8,62 +8,48 @@
 #include <QPainter>
 #include <QVector2D>
 #include <QVector>
+#include <QTimer>
+#include <QHash>
+#include <QThreadPool>
+#include <QElapsedTimer>
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <climits>
+
+#include "viewtransform.hpp"
+#include "imagepyramid.hpp"
+#include "imageloader.hpp"
+#include "shapestore.hpp"
+#include "commandlog.hpp"
+#include "shapeindex.hpp"
+#include "polygonlod.hpp"
+#include "regionstats.hpp"
+#include "varint.hpp"
 
 #define POLYGON_END_RADIUS 40
 #define VERTEX_SIZE 20
+#define QUALITY_DELAY 200 // ms after last view change or drag before high quality repaint
+#define INTERACTIVE_LOD_FACTOR 4 // outlines are this many times coarser while dragging
+#define RENDER_TILE_SIZE 256 // widget pixels per side of tile painted on own thread
+#define RENDER_TILE_MIN_SHAPES 512 // fewer visible shapes are painted on GUI thread
+#define BOUNDS_MARGIN 2 // extra pixels around shape bounds for pen width
+#define ZOOM_STEP 1.25 // zoom factor per mouse wheel notch
+#define MIN_ZOOM 0.1 // relative to fit-to-window scale
+#define MAX_SCALE 32.0 // widget pixels per image pixel
+#define SNAP_RADIUS 10 // image pixels
+#define EYEDROPPER_SIZE 3 // default NxN sampling kernel
+#define EYEDROPPER_MAX_SIZE 51
+#define EYEDROPPER_SWATCH 32 // preview swatch size in widget pixels
+#define FRAME_INTERVAL 16 // ms, used when screen refresh rate is unknown
+#define LATENCY_SMOOTHING 0.1 // weight of newest frame in averaged latency
 
 class MainWindow;
 
 enum class ToolType
 {
-  NONE, Polygon, Circle, Rectangle, Color, Select, TOOLTYPE_MAX
-};
-
-enum class ShapeType
-{
-  Circle, Rectangle, Line, Polygon, SHAPETYPE_MAX 
-};
-
-struct Color
-{
-  int r;
-  int g;
-  int b;
-
-  Color(QColor c) : r{c.red()}, g{c.green()}, b{c.blue()} {}
-  Color(int r, int g, int b) : r{r}, g{g}, b{b} {}
-};
-
-struct Vec2
-{
-  int32_t x;
-  int32_t y;
-
-  Vec2(QPoint p) : x{p.x()}, y{p.y()} {}
-  Vec2(QVector2D v) : Vec2{v.toPoint()} {}
-  Vec2(int x, int y) : x{x}, y{y} {}
-};
-
-struct Shape
-{
-  ShapeType type{ShapeType::SHAPETYPE_MAX};
-  Vec2 position{0,0};
-  Vec2 size{0,0};
-  Color color{0,0,0};
-  QVector<QPoint> vertices;
-
-  Shape(ShapeType t, Vec2 p, Vec2 s, Color c)
-    : type{t}, position{p}, size{s}, color{c}
-  {};
-  
-  Shape(ShapeType t, Vec2 p, Color c)
-    : type{t}, position{p}, size{0,0}, color{c}
-  {};
-
-  Shape() {}
+  NONE, Polygon, Circle, Rectangle, Color, Select, Eyedropper, TOOLTYPE_MAX
 };
 
 class RenderArea : public QWidget
@@ -75,47 +61,98 @@ class RenderArea : public QWidget
       ~RenderArea();
       bool loadImage(const QString &fileName);
       inline QImage *getImage() { return this->image; }
+      inline bool hasImage() { return image && !image->isNull(); }
       void paintEvent(QPaintEvent *event);
       void mouseMoveEvent(QMouseEvent *event);
       void mousePressEvent(QMouseEvent *event);
       void mouseReleaseEvent(QMouseEvent *event);
+      void resizeEvent(QResizeEvent *event);
+      void wheelEvent(QWheelEvent *event);
+      void leaveEvent(QEvent *event);
+
+      void zoomAt(QPoint center, double factor);
+      void resetView();
+      // high quality repaint now instead of after QUALITY_DELAY
+      void endInteraction();
  
-      inline void setTool(ToolType type) { tool = type; }
-      inline auto getShapes() { return shapes; }
-      inline void addShape(Shape *shape) { shapes.push_back(shape); }
+      inline void setTool(ToolType type)
+      {
+        if (type != ToolType::Eyedropper) hideEyedropper();
+        tool = type;
+        // selection handles depend on tool
+        invalidateStaticLayer();
+      }
+      inline const std::vector<Shape*> &getShapes() const { return shapes; }
+      // row of shape in list, -1 for shape being drawn or deleted
+      inline int rowOf(const Shape *shape) const
+      {
+        int row = shape ? shape->row : -1;
+        return row >= 0 && row < (int)shapes.size() && shapes[row] == shape ? row : -1;
+      }
+      // image-space box of shape with its handles, as cached in Shape::imageBounds
+      QRect computeImageBounds(Shape *shape);
+      // replaces all shapes with loaded ones, shapes must be owned by loaded store
+      void setShapes(ShapeStore &&loaded, const std::vector<Shape*> &newShapes);
+      inline Shape *findShape(quint32 id) const { return store.find(id); }
 
       inline QPoint toImageSpace(int x, int y) { return toImageSpace(QPoint(x,y)); }
-      QPoint toImageSpace(QPoint point);
+      inline QPoint toImageSpace(QPoint point) { return view.unmap(point); }
 
-      QPoint toWidgetSpace(QPoint point);
+      inline QPoint toWidgetSpace(QPoint point) { return view.map(point); }
       inline QPoint toWidgetSpace(int x, int y) { return toWidgetSpace(QPoint(x, y)); }
   
       inline void setColor(QColor c) { color = c; }
-      inline void setSelected(Shape *s) { selectedShape = s; tool = ToolType::Select; repaint(); }
 
-      inline void deleteShape(Shape *shape)
+      // mean color of NxN image pixels around image-space point
+      QColor sampleColor(QPoint imagePos) const;
+      inline void setLatencyOverlay(bool on)
+      {
+        latencyOverlay = on;
+        latencyMax = 0.0;
+        update(latencyRect());
+      }
+      inline void setEyedropperSize(int size) { eyedropperSize = qBound(1, size | 1, EYEDROPPER_MAX_SIZE); }
+      inline int getEyedropperSize() const { return eyedropperSize; }
+      inline void setSelected(Shape *s)
+      {
+        QRect dirty = shapeBounds(selectedShape) | shapeBounds(s);
+        selectedShape = s;
+        invalidateStaticLayer();
+        hideEyedropper();
+        tool = ToolType::Select;
+        if (s && !getStats(s)) requestStats(s);
+        update(dirty);
+      }
+
+      // deleting, moving and recoloring shapes is recorded for undo
+      void deleteShape(Shape *shape);
+      void recolorShape(Shape *shape, QColor c);
+      inline Shape *getSelected() const { return selectedShape; }
+
+      void undo();
+      void redo();
+      inline bool canUndo() const { return history.canUndo(); }
+      inline bool canRedo() const { return history.canRedo(); }
+      inline void setHistoryBudget(size_t bytes) { history.setBudget(bytes); }
+
+      static inline size_t serializedShapeSize(const Shape *shape)
       {
-        shapes.erase(std::remove(shapes.begin(), shapes.end(), shape), shapes.end());
-        delete shape;
-        repaint();
-        this->currentShape = nullptr;
-        this->selectedShape = nullptr;
+        size_t verticesSize = (size_t)(shape->vertices.size());
+        if (shape->type != ShapeType::Polygon) verticesSize = 0;
+
+        return sizeof(uint8_t) + sizeof(int32_t)*4 + sizeof(int)*3 + sizeof(size_t) + sizeof(int32_t)*2*verticesSize;
       }
 
-      static inline std::pair<int8_t*,size_t> serializeShape(Shape *shape)
+      // writes record into data which must hold serializedShapeSize(shape) bytes
+      static inline size_t serializeShape(const Shape *shape, int8_t *data)
       {
         /*
          * u8[type] i32[pos.x] i32[pos.y] i32[size.x] i32[size.y] i[r] i[g] i[b] size_t[vertices.size] i32[v1.x] i32[v1.y] ...
          */
         int8_t type = (int8_t)shape->type;
-        size_t vertexDataSize = sizeof(int32_t) * 2;
         size_t verticesSize = (size_t)(shape->vertices.size());
         if (shape->type != ShapeType::Polygon) verticesSize = 0;
 
-        size_t dataSize = sizeof(uint8_t) + sizeof(int32_t)*4 + sizeof(int)*3 + sizeof(size_t) + vertexDataSize*verticesSize;
-
-        int8_t *data = new int8_t[dataSize];
-
         size_t p = 0;
         auto serial = [data, &p](const void *src, size_t n)
         {
@@ -123,7 +160,6 @@ class RenderArea : public QWidget
           p += n;
         };
         serial(&type, sizeof(int8_t));
-        printf("%d\n", type);
         serial(&shape->position.x, sizeof(int32_t));
         serial(&shape->position.y, sizeof(int32_t));
         serial(&shape->size.x, sizeof(int32_t));
@@ -134,25 +170,30 @@ class RenderArea : public QWidget
         serial(&verticesSize, sizeof(size_t));
         if (verticesSize > 0)
         {
-          for (const auto &v : shape->vertices)
+          const QPoint *v = shape->vertices.constData();
+          for (size_t i = 0; i < verticesSize; i++)
           {
-            int32_t x = v.x();
-            int32_t y = v.y();
-            serial(&x, sizeof(int32_t));
-            serial(&y, sizeof(int32_t));
+            int32_t xy[2] = { v[i].x(), v[i].y() };
+            serial(xy, sizeof(xy));
           }
         }
 
-        return std::make_pair(data, dataSize);
+        return p;
+      }
+
+      static inline size_t serializedShapeHeaderSize()
+      {
+        return sizeof(uint8_t) + sizeof(int32_t)*4 + sizeof(int)*3 + sizeof(size_t);
       }
 
-      static inline std::pair<Shape*,size_t> deserializeShape(int8_t *data, size_t dsize)
+      // fills shape from record, returns 0 when record does not fit in dsize bytes or is corrupt
+      static inline size_t deserializeShape(const int8_t *data, size_t dsize, Shape &shape)
       {
         size_t p = 0;
-        Shape *shape = new Shape();
         /*
          * u8[type] i32[pos.x] i32[pos.y] i32[size.x] i32[size.y] i[r] i[g] i[b] size_t[vertices.size] i32[v1.x] i32[v1.y] ...
          */
+        if (dsize < serializedShapeHeaderSize()) return 0;
 
         auto deserial = [data, &p](void *dest, size_t size)
         {
@@ -160,65 +201,389 @@ class RenderArea : public QWidget
           p += size;
         };
 
-        deserial(&shape->type, sizeof(int8_t));
-        deserial(&shape->position.x, sizeof(int32_t));
-        deserial(&shape->position.y, sizeof(int32_t));
-        deserial(&shape->size.x, sizeof(int32_t));
-        deserial(&shape->size.y, sizeof(int32_t));
-        deserial(&shape->color.r, sizeof(int));
-        deserial(&shape->color.g, sizeof(int));
-        deserial(&shape->color.b, sizeof(int));
+        int8_t type;
+        deserial(&type, sizeof(int8_t));
+        if (type < 0 || type >= (int8_t)ShapeType::SHAPETYPE_MAX) return 0;
+
+        shape.type = (ShapeType)type;
+        deserial(&shape.position.x, sizeof(int32_t));
+        deserial(&shape.position.y, sizeof(int32_t));
+        deserial(&shape.size.x, sizeof(int32_t));
+        deserial(&shape.size.y, sizeof(int32_t));
+        deserial(&shape.color.r, sizeof(int));
+        deserial(&shape.color.g, sizeof(int));
+        deserial(&shape.color.b, sizeof(int));
 
         size_t verticesSize;
         deserial(&verticesSize, sizeof(size_t));
 
-        if (p > dsize)
+        // count is validated against remaining bytes before anything is read
+        const size_t vertexDataSize = sizeof(int32_t) * 2;
+        if (verticesSize > (dsize - p) / vertexDataSize || verticesSize > (size_t)INT_MAX)
         {
-          qDebug("Data pointer outside data! %lu > %lu\n", p, dsize);
+          qDebug("Shape record needs %zu vertices, only %zu bytes left!", verticesSize, dsize - p);
+          return 0;
         }
 
+        shape.vertices.resize((int)verticesSize);
+        QPoint *v = shape.vertices.data();
         for (size_t i = 0; i < verticesSize; i++)
         {
-          int32_t x, y;
-          deserial(&x, sizeof(int32_t));
-          deserial(&y, sizeof(int32_t));
-          shape->vertices.push_back(QPoint(x, y));
+          int32_t xy[2];
+          deserial(xy, sizeof(xy));
+          v[i] = QPoint(xy[0], xy[1]);
         }
         
-        return {shape, p};
+        return p;
+      }
+
+      /*
+       * GK2 v2 record:
+       * u8[type] z[pos.x] z[pos.y] z[size.x] z[size.y] u8[r] u8[g] u8[b] v[vertices.size] z[v1-pos] z[v2-v1] ...
+       * v = varint, z = zigzag varint, vertices are delta-encoded per coordinate
+       */
+      static inline size_t serializedShapeSizeV2(const Shape *shape)
+      {
+        uint32_t verticesSize = shape->type == ShapeType::Polygon ? (uint32_t)shape->vertices.size() : 0;
+        size_t size = sizeof(uint8_t)*4 + varintSize(verticesSize);
+        size += varintSize(zigzag(shape->position.x)) + varintSize(zigzag(shape->position.y));
+        size += varintSize(zigzag(shape->size.x)) + varintSize(zigzag(shape->size.y));
+
+        uint32_t px = (uint32_t)shape->position.x, py = (uint32_t)shape->position.y;
+        const QPoint *v = shape->vertices.constData();
+        for (uint32_t i = 0; i < verticesSize; i++)
+        {
+          size += varintSize(zigzag((int32_t)((uint32_t)v[i].x() - px)));
+          size += varintSize(zigzag((int32_t)((uint32_t)v[i].y() - py)));
+          px = (uint32_t)v[i].x();
+          py = (uint32_t)v[i].y();
+        }
+        return size;
+      }
+
+      static inline size_t serializeShapeV2(const Shape *shape, uint8_t *data)
+      {
+        uint32_t verticesSize = shape->type == ShapeType::Polygon ? (uint32_t)shape->vertices.size() : 0;
+
+        size_t p = 0;
+        data[p++] = (uint8_t)shape->type;
+        p += writeVarint(data+p, zigzag(shape->position.x));
+        p += writeVarint(data+p, zigzag(shape->position.y));
+        p += writeVarint(data+p, zigzag(shape->size.x));
+        p += writeVarint(data+p, zigzag(shape->size.y));
+        data[p++] = (uint8_t)qBound(0, shape->color.r, 255);
+        data[p++] = (uint8_t)qBound(0, shape->color.g, 255);
+        data[p++] = (uint8_t)qBound(0, shape->color.b, 255);
+        p += writeVarint(data+p, verticesSize);
+
+        // deltas are computed with wrap-around so any int32 coordinates round-trip
+        uint32_t px = (uint32_t)shape->position.x, py = (uint32_t)shape->position.y;
+        const QPoint *v = shape->vertices.constData();
+        for (uint32_t i = 0; i < verticesSize; i++)
+        {
+          p += writeVarint(data+p, zigzag((int32_t)((uint32_t)v[i].x() - px)));
+          p += writeVarint(data+p, zigzag((int32_t)((uint32_t)v[i].y() - py)));
+          px = (uint32_t)v[i].x();
+          py = (uint32_t)v[i].y();
+        }
+        return p;
+      }
+
+      // fills shape from record, returns 0 when record does not fit in dsize bytes or is corrupt
+      static inline size_t deserializeShapeV2(const uint8_t *data, size_t dsize, Shape &shape)
+      {
+        size_t p = 0;
+        uint32_t value;
+        auto varint = [data, dsize, &p, &value]() -> bool
+        {
+          size_t n = readVarint(data+p, dsize-p, value);
+          p += n;
+          return n > 0;
+        };
+
+        if (dsize < 1 || data[0] >= (uint8_t)ShapeType::SHAPETYPE_MAX) return 0;
+
+        shape.type = (ShapeType)data[p++];
+
+        int32_t fields[4];
+        for (auto &f : fields)
+        {
+          if (!varint()) return 0;
+          f = unzigzag(value);
+        }
+        shape.position = Vec2(fields[0], fields[1]);
+        shape.size = Vec2(fields[2], fields[3]);
+
+        if (dsize - p < 3) return 0;
+        shape.color = Color(data[p], data[p+1], data[p+2]);
+        p += 3;
+
+        // every vertex takes at least two bytes, count is validated before reserving
+        if (!varint() || value > (dsize - p) / 2 || value > (uint32_t)INT_MAX)
+        {
+          return 0;
+        }
+        uint32_t verticesSize = value;
+
+        shape.vertices.resize((int)verticesSize);
+        QPoint *v = shape.vertices.data();
+        uint32_t px = (uint32_t)shape.position.x, py = (uint32_t)shape.position.y;
+        for (uint32_t i = 0; i < verticesSize; i++)
+        {
+          if (!varint()) return 0;
+          px += (uint32_t)unzigzag(value);
+          if (!varint()) return 0;
+          py += (uint32_t)unzigzag(value);
+          v[i] = QPoint((int32_t)px, (int32_t)py);
+        }
+
+        return p;
       }
 
+      // color statistics of image under shape, nullptr until computed
+      inline const RegionStats *getStats(Shape *shape) const
+      {
+        auto it = stats.constFind(shape);
+        return it != stats.constEnd() ? &it.value() : nullptr;
+      }
+      // computed on worker thread, statsChanged is emitted when done
+      void requestStats(Shape *shape);
+
       std::string fileName;
+
+  signals:
+      void loadProgress(int percent, const QString &message);
+      void loadFailed(const QString &fileName);
+      void statsChanged(Shape *shape);
+      void colorPicked(const QColor &color);
+      // rows of shapes in drawing order
+      void shapeAboutToBeInserted(int row);
+      void shapeInserted(int row);
+      void shapeAboutToBeRemoved(int row);
+      void shapeRemoved(int row);
+      // shape already in list changed in place (moved, edited, recolored)
+      void shapeModified(Shape *shape);
+      void historyChanged();
+
   private:
       QWidget *myParent;
+      // best decoded version of image (preview or full resolution)
       QImage *image{nullptr};
+      // full resolution size, defines image space
+      QSize imageSize;
+      ImageLoader *loader{nullptr};
+      bool newImagePending{false};
+
+      void setImage(const QImage &img, std::vector<QImage> levels, QSize fullSize);
       ToolType tool{ToolType::NONE};
       QColor color;
 
+      // owns committed shapes and shape being drawn
+      ShapeStore store;
+      // committed shapes in drawing order
       std::vector<Shape*> shapes;
       Shape *currentShape{nullptr};
+
+      // undo history of edits
+      CommandLog history;
+      inline void record(Command command)
+      {
+        history.push(std::move(command));
+        emit historyChanged();
+      }
+      void applyCommand(Command &command, bool undo);
+      // shape order, index and list rows are updated together
+      void insertShape(Shape *shape, int row);
+      void removeShape(Shape *shape);
       Shape *selectedShape{nullptr};
       int selectedVertex{-1};
       bool selectedOrigin{false};
+      bool selectionPicked{false};
+      // selected shape changed by current drag, its stats are refreshed on release
+      bool dragChanged{false};
+
+      // eyedropper kernel and live preview under cursor
+      int eyedropperSize{EYEDROPPER_SIZE};
+      QPoint eyedropperPos;
+      QColor eyedropperColor;
+
+      QRect eyedropperKernel();
+      QRect eyedropperRect();
+      void drawEyedropper(QPainter &painter);
+      inline void hideEyedropper()
+      {
+        if (!eyedropperColor.isValid()) return;
+        update(eyedropperRect());
+        eyedropperColor = QColor();
+      }
+
+      // mouse moves are coalesced, latest position is applied once per frame
+      QPoint movePos;
+      Qt::KeyboardModifiers moveModifiers;
+      // image-space cursor position of last applied move, drags start at press
+      QPoint lastMovePos;
+      bool movePending{false};
+      int coalescedMoves{0};
+      QTimer *frameTimer{nullptr};
+      QElapsedTimer frameClock;
+      qint64 lastFrameTime{0};
+
+      void applyMove();
+      int frameInterval();
+      // press and release have to see position of last move
+      inline void flushMove()
+      {
+        if (!movePending) return;
+        frameTimer->stop();
+        applyMove();
+      }
+
+      // time from first coalesced move to end of paint showing it,
+      // compositor adds up to one more frame on top of it
+      bool latencyOverlay{false};
+      qint64 inputTime{-1};
+      qint64 appliedInputTime{-1};
+      double latencyAverage{0.0};
+      double latencyMax{0.0};
+      int frameMoves{0};
+
+      QRect latencyRect();
+      void drawLatency(QPainter &painter);
+
+      // image-space lookup of shapes and vertices for picking and snapping
+      ShapeIndex index;
 
       void drawShape(Shape *shape, QPainter &painter);
+      // background and shapes intersecting dirty, skip is left out
+      void drawScene(QPainter &painter, const QRect &dirty, Shape *skip);
+      void drawTiled(QPainter &painter, const QRect &dirty, const std::vector<Shape*> &visibleShapes);
+      inline double outlineScale() const
+      {
+        double scale = std::max(view.scaleX, view.scaleY);
+        return interacting ? scale / INTERACTIVE_LOD_FACTOR : scale;
+      }
+
+      // background and all shapes except dragged one, painted once per drag
+      // and blitted on every frame of it
+      QPixmap staticLayer;
+      Shape *staticLayerActive{nullptr};
+      quint32 staticLayerView{0};
+      bool staticLayerValid{false};
+      inline void invalidateStaticLayer() { staticLayerValid = false; }
+      void rebuildStaticLayer(Shape *active);
+      inline void renumberRows(int from)
+      {
+        for (size_t i = from; i < shapes.size(); i++)
+          shapes[i]->row = (int)i;
+      }
+
+      // simplified outlines of committed polygons
+      PolygonLod lod;
+      // builds missing outline level on GUI thread, drawShape only reads it
+      inline void prepareOutline(const Shape *shape)
+      {
+        // polygon being drawn is always drawn whole
+        if (!shape || shape == currentShape || shape->type != ShapeType::Polygon) return;
+        int count;
+        lod.points(shape, outlineScale(), count);
+      }
       QPoint shapeCreationPosition;
 
-      inline QPoint realImageSize()
+      // image to widget space mapping, recomputed only when view changes
+      ViewTransform view;
+      // incremented whenever widget-space mapping changes
+      quint32 viewGeneration{1};
+
+      // zoom relative to fit-to-window and pan offset in widget pixels
+      double zoom{1.0};
+      QPointF pan{0.0, 0.0};
+      bool panning{false};
+      QPoint panLastPos;
+
+      void updateViewTransform();
+      void viewChanged();
+      inline QRect visibleImageRect(const QRect &widgetRect)
       {
-        double imageRatio = (double)image->width() / (double)image->height();
+        return view.unmapRect(widgetRect).adjusted(-1, -1, 1, 1) & QRect(QPoint(0, 0), imageSize);
+      }
 
-        int w = width(), h = height();
-        int iw = w, ih = h;
-        iw = ih*imageRatio;
-        if (w < iw) 
+      inline QRect refreshBounds(Shape *shape)
+      {
+        if (!shape) return QRect();
+        // bounds are refreshed after every geometry change
+        shape->revision++;
+        shape->imageBounds = computeImageBounds(shape);
+        shape->imageBoundsValid = true;
+        shape->bounds = view.mapRect(shape->imageBounds)
+          .adjusted(-BOUNDS_MARGIN, -BOUNDS_MARGIN, BOUNDS_MARGIN, BOUNDS_MARGIN);
+        shape->boundsView = viewGeneration;
+        return shape->bounds;
+      }
+      inline QRect shapeImageBounds(Shape *shape)
+      {
+        if (!shape) return QRect();
+        if (!shape->imageBoundsValid) refreshBounds(shape);
+        return shape->imageBounds;
+      }
+      inline QRect shapeBounds(Shape *shape)
+      {
+        if (!shape || !image) return QRect();
+        if (!shape->imageBoundsValid) return refreshBounds(shape);
+        if (shape->boundsView != viewGeneration)
         {
-          iw = w;
-          ih = w*(1.0/imageRatio);
+          // only remap cached image-space box, vertices are not visited
+          shape->bounds = view.mapRect(shape->imageBounds)
+            .adjusted(-BOUNDS_MARGIN, -BOUNDS_MARGIN, BOUNDS_MARGIN, BOUNDS_MARGIN);
+          shape->boundsView = viewGeneration;
         }
+        return shape->bounds;
+      }
 
-        //qDebug("%d %d (%d %d) [%d %d] %f\n", w, h, iw, ih, image->width(), image->height(), imageRatio);
-        return QPoint(iw, ih);
+      // tiled mip-mapped background image
+      ImagePyramid pyramid;
+
+      // visible part of background image scaled to current view,
+      // composed from pyramid tiles only when view or image changes
+      QPixmap scaledImage;
+      QRect scaledImageRect;
+      quint32 scaledImageView{0};
+      qint64 scaledImageKey{0};
+      bool scaledImageSmooth{false};
+
+      void rebuildScaledImage(Qt::TransformationMode mode);
+
+      // while view or shape is dragged painting is fast (no antialiasing,
+      // fast scaling, coarse outlines), one high quality pass follows when
+      // input stops for QUALITY_DELAY
+      bool interacting{false};
+      QTimer *qualityTimer{nullptr};
+      inline void beginInteraction()
+      {
+        interacting = true;
+        qualityTimer->start();
       }
 
+      // per-shape statistics, each shape has at most one task running
+      enum class StatsTask
+      {
+        Running,
+        Stale,   // shape changed meanwhile, rerun when finished
+        Dropped, // shape deleted, result is discarded
+        Replaced // deleted and address reused by new shape, discard and rerun
+      };
+      QHash<Shape*, RegionStats> stats;
+      QHash<Shape*, StatsTask> statsTasks;
+      QThreadPool statsPool;
+
+      void statsComputed(Shape *shape, const RegionStats &s);
+      inline void dropStats(Shape *shape)
+      {
+        stats.remove(shape);
+        if (statsTasks.contains(shape))
+          statsTasks[shape] = StatsTask::Dropped;
+      }
+      inline bool scaledImageValid()
+      {
+        return scaledImageView == viewGeneration && scaledImageKey == image->cacheKey();
+      }
 };
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <QColor>
+#include <QPoint>
+#include <QRect>
+#include <QVector2D>
+
+#include <cstdint>
+#include <vector>
+
+#define VERTEX_MIN_CAPACITY 4
+#define VERTEX_CHUNK_SIZE (64*1024) // points allocated from heap at once
+
+enum class ShapeType
+{
+  Circle, Rectangle, Line, Polygon, SHAPETYPE_MAX 
+};
+
+struct Color
+{
+  int r;
+  int g;
+  int b;
+
+  Color(QColor c) : r{c.red()}, g{c.green()}, b{c.blue()} {}
+  Color(int r, int g, int b) : r{r}, g{g}, b{b} {}
+};
+
+struct Vec2
+{
+  int32_t x;
+  int32_t y;
+
+  Vec2(QPoint p) : x{p.x()}, y{p.y()} {}
+  Vec2(QVector2D v) : Vec2{v.toPoint()} {}
+  Vec2(int x, int y) : x{x}, y{y} {}
+};
+
+/*
+ * Pool of vertex blocks with power-of-two capacities carved out of large
+ * chunks. Released blocks are reused by the next allocation of the same
+ * capacity, so vertices of many shapes share few heap allocations.
+ * Not thread-safe, arena-backed arrays are modified on GUI thread only.
+ */
+class VertexArena
+{
+  public:
+    VertexArena() {}
+    ~VertexArena();
+    VertexArena(const VertexArena&) = delete;
+    VertexArena &operator=(const VertexArena&) = delete;
+
+    // capacity must be power of two not smaller than VERTEX_MIN_CAPACITY
+    QPoint *allocate(int capacity);
+    void release(QPoint *block, int capacity);
+
+    inline size_t chunkCount() const { return chunks.size(); }
+
+  private:
+    static int sizeClass(int capacity);
+
+    std::vector<QPoint*> chunks;
+    QPoint *chunkPos{nullptr};
+    int chunkLeft{0};
+    // released blocks per size class
+    std::vector<std::vector<QPoint*>> freeBlocks;
+};
+
+/*
+ * Vertex list with QVector-like interface. Storage comes from arena when
+ * one is given, otherwise from heap. Copies are always heap-backed, so
+ * they can be handed to worker threads while original keeps changing.
+ */
+class VertexArray
+{
+  public:
+    VertexArray() {}
+    explicit VertexArray(VertexArena *arena) : arena{arena} {}
+    VertexArray(const VertexArray &other);
+    VertexArray(VertexArray &&other);
+    ~VertexArray();
+
+    // assignment keeps storage of this array
+    VertexArray &operator=(const VertexArray &other);
+    VertexArray &operator=(VertexArray &&other);
+
+    inline int size() const { return count; }
+    inline bool isEmpty() const { return count == 0; }
+
+    inline const QPoint &at(int i) const { return points[i]; }
+    inline QPoint &operator[](int i) { return points[i]; }
+    inline const QPoint &operator[](int i) const { return points[i]; }
+    inline QPoint *data() { return points; }
+    inline const QPoint *data() const { return points; }
+    inline const QPoint *constData() const { return points; }
+
+    inline QPoint *begin() { return points; }
+    inline QPoint *end() { return points + count; }
+    inline const QPoint *begin() const { return points; }
+    inline const QPoint *end() const { return points + count; }
+
+    inline void push_back(const QPoint &p)
+    {
+      if (count == capacity) reallocate(count + 1);
+      points[count++] = p;
+    }
+    inline void append(const QPoint &p) { push_back(p); }
+    inline void replace(int i, const QPoint &p) { points[i] = p; }
+
+    void resize(int n);
+    void reserve(int n);
+    void clear();
+    // releases storage and switches to other pool (or heap)
+    inline void reset(VertexArena *pool)
+    {
+      clear();
+      arena = pool;
+    }
+
+  private:
+    void reallocate(int minCapacity);
+    void assign(const QPoint *src, int n);
+
+    VertexArena *arena{nullptr};
+    QPoint *points{nullptr};
+    int count{0};
+    int capacity{0};
+};
+
+struct Shape
+{
+  ShapeType type{ShapeType::SHAPETYPE_MAX};
+  Vec2 position{0,0};
+  Vec2 size{0,0};
+  Color color{0,0,0};
+  VertexArray vertices;
+
+  // stable identifier given by ShapeStore, 0 for shapes outside of store
+  quint32 id{0};
+  // incremented on every geometry change, keys caches derived from vertices
+  quint32 revision{0};
+  // position in RenderArea shape list (drawing order), -1 while not listed
+  int row{-1};
+
+  // cached image-space bounding box including anchor and vertex handles
+  QRect imageBounds;
+  bool imageBoundsValid{false};
+
+  // cached widget-space bounding box, valid while boundsView matches view
+  QRect bounds;
+  quint32 boundsView{0};
+
+  Shape(ShapeType t, Vec2 p, Vec2 s, Color c)
+    : type{t}, position{p}, size{s}, color{c}
+  {};
+  
+  Shape(ShapeType t, Vec2 p, Color c)
+    : type{t}, position{p}, size{0,0}, color{c}
+  {};
+
+  Shape() {}
+
+  // move anchor of non-polygon shapes is not serialized, it lies at position + size/2
+  inline void restoreAnchor()
+  {
+    if (type != ShapeType::Polygon)
+      vertices.append(QPoint(position.x + size.x/2, position.y + size.y/2));
+  }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+#include <vector>
+
+#define INDEX_CELL_SIZE 128 // image pixels per grid cell side
+
+struct Shape;
+
+struct VertexRef
+{
+  Shape *shape;
+  int index;
+};
+
+/*
+ * Uniform grid over image space. Shapes are stored in every cell their
+ * bounds overlap, vertices in the cell they lie in. Updated incrementally
+ * when single vertices or whole shapes move.
+ */
+class ShapeIndex
+{
+  public:
+    void clear();
+
+    void insert(Shape *shape, const QRect &bounds);
+    void remove(Shape *shape);
+    // bounds are reindexed only when covered cells change
+    void updateBounds(Shape *shape, const QRect &bounds);
+
+    void insertVertices(Shape *shape);
+    void removeVertices(Shape *shape);
+    void moveVertex(Shape *shape, int index, const QPoint &from, const QPoint &to);
+
+    // shapes whose bounds intersect rect (unordered, without duplicates)
+    void query(const QRect &rect, std::vector<Shape*> &result) const;
+
+    // smallest shape which contains point
+    Shape *pick(const QPoint &p) const;
+
+    // closest vertex within radius (manhattan distance), only of given shape if set
+    bool nearestVertex(const QPoint &p, int radius, VertexRef &result, const Shape *only = nullptr) const;
+
+    // position of closest vertex of other shape within radius or p itself
+    QPoint snap(const QPoint &p, int radius, const Shape *ignore) const;
+
+  private:
+    QHash<quint64, QVector<Shape*>> shapeCells;
+    QHash<quint64, QVector<VertexRef>> vertexCells;
+    // covered cells range of every indexed shape
+    QHash<Shape*, QRect> shapeRanges;
+
+    static inline int cellOf(int v)
+    {
+      return v >= 0 ? v / INDEX_CELL_SIZE : (v - INDEX_CELL_SIZE + 1) / INDEX_CELL_SIZE;
+    }
+    static inline quint64 cellKey(int cx, int cy)
+    {
+      return ((quint64)(quint32)cx << 32) | (quint64)(quint32)cy;
+    }
+    static inline QRect cellRange(const QRect &r)
+    {
+      return QRect(QPoint(cellOf(r.left()), cellOf(r.top())), QPoint(cellOf(r.right()), cellOf(r.bottom())));
+    }
+
+    void addCells(Shape *shape, const QRect &range);
+    void removeCells(Shape *shape, const QRect &range);
+    static bool contains(const Shape *shape, const QPoint &p);
+};
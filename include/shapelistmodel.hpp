@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QIcon>
+
+class RenderArea;
+struct Shape;
+struct RegionStats;
+
+#define HISTOGRAM_ICON_SIZE 32
+
+/*
+ * Rows of shapes list read straight from RenderArea shapes, nothing is
+ * allocated per shape. Row of shape is its position in getShapes().
+ */
+class ShapeListModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+  public:
+    ShapeListModel(QObject *parent = nullptr);
+
+    // switching area resets whole model
+    void setArea(RenderArea *area);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    Shape *shapeAt(int row) const;
+    int rowOf(Shape *shape) const;
+
+    // connected to row signals of area
+    void beginInsertShape(int row);
+    void endInsertShape();
+    void beginRemoveShape(int row);
+    void endRemoveShape();
+    // many shapes added at once are announced by one reset
+    void beginBulkLoad();
+    void endBulkLoad();
+
+    void statsChanged(Shape *shape);
+
+  private:
+    RenderArea *area{nullptr};
+    // histogram icons of shapes with statistics
+    mutable QHash<Shape*, QIcon> icons;
+
+    static QIcon histogramIcon(const RegionStats &stats);
+};
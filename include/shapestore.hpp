@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QHash>
+
+#include <memory>
+#include <vector>
+
+#include "shape.hpp"
+
+#define SHAPE_BLOCK_SIZE 1024 // shapes allocated at once
+
+/*
+ * Owner of all shapes of project. Shapes live in blocks of
+ * SHAPE_BLOCK_SIZE contiguous headers and never move, so Shape pointers
+ * stay valid until destroy(). Freed slots are reused through free list,
+ * creation and destruction are O(1). Vertices are allocated from one
+ * VertexArena shared by all shapes of store.
+ */
+class ShapeStore
+{
+  public:
+    ShapeStore();
+    ~ShapeStore();
+    ShapeStore(ShapeStore &&other);
+    ShapeStore &operator=(ShapeStore &&other);
+    ShapeStore(const ShapeStore&) = delete;
+    ShapeStore &operator=(const ShapeStore&) = delete;
+
+    // id is given from counter unless previously used id is requested
+    Shape *create(quint32 id = 0);
+    Shape *create(ShapeType type, Vec2 position, Vec2 size, Color color);
+    void destroy(Shape *shape);
+    void clear();
+
+    inline Shape *find(quint32 id) const { return ids.value(id, nullptr); }
+    inline size_t size() const { return (size_t)ids.size(); }
+    inline VertexArena *vertexArena() { return arena.get(); }
+
+  private:
+    std::vector<std::unique_ptr<Shape[]>> blocks;
+    std::vector<Shape*> freeSlots;
+    // vertices of shapes in blocks point into arena, it is released last
+    std::unique_ptr<VertexArena> arena;
+    QHash<quint32, Shape*> ids;
+    quint32 nextId{1};
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * LEB128 varints and zigzag mapping of signed values used by GK2 v2 format.
+ * Byte order of encoded values does not depend on platform.
+ */
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline size_t varintSize(uint32_t v)
+{
+  size_t n = 1;
+  while (v >= 0x80)
+  {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static inline size_t writeVarint(uint8_t *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+// returns number of bytes read, 0 when data ends or value is longer than 5 bytes
+static inline size_t readVarint(const uint8_t *in, size_t size, uint32_t &v)
+{
+  v = 0;
+  for (size_t n = 0; n < size && n < 5; n++)
+  {
+    v |= (uint32_t)(in[n] & 0x7f) << (7*n);
+    if (!(in[n] & 0x80)) return n + 1;
+  }
+  return 0;
+}
+
+static inline void writeU32LE(uint8_t *out, uint32_t v)
+{
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+  out[2] = (uint8_t)(v >> 16);
+  out[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t readU32LE(const uint8_t *in)
+{
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
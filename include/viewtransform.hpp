@@ -0,0 +1,89 @@
+#pragma once
+
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+
+/*
+ * Mapping between image space and widget space:
+ *   widget = offset + image * scale
+ *   image  = (widget - offset) * invScale
+ * Computed once per resize/zoom instead of per converted point.
+ */
+struct ViewTransform
+{
+  double offsetX{0.0};
+  double offsetY{0.0};
+  double scaleX{1.0};
+  double scaleY{1.0};
+  double invScaleX{1.0};
+  double invScaleY{1.0};
+
+  ViewTransform() {}
+  ViewTransform(double ox, double oy, double sx, double sy)
+    : offsetX{ox}, offsetY{oy}, scaleX{sx}, scaleY{sy},
+      invScaleX{1.0/sx}, invScaleY{1.0/sy}
+  {};
+
+  inline QPoint map(const QPoint &p) const
+  {
+    return QPoint(offsetX + p.x()*scaleX, offsetY + p.y()*scaleY);
+  }
+
+  inline QPoint unmap(const QPoint &p) const
+  {
+    return QPoint((p.x() - offsetX)*invScaleX, (p.y() - offsetY)*invScaleY);
+  }
+
+  inline QRect mapRect(const QRect &r) const
+  {
+    return QRect(map(r.topLeft()), map(r.bottomRight())).normalized();
+  }
+
+  inline QRect unmapRect(const QRect &r) const
+  {
+    return QRect(unmap(r.topLeft()), unmap(r.bottomRight())).normalized();
+  }
+
+  // batch conversion of whole vertex arrays, dst may alias src
+  inline void mapPoints(const QPoint *src, QPoint *dst, int n) const
+  {
+    const double ox = offsetX, oy = offsetY, sx = scaleX, sy = scaleY;
+    for (int i = 0; i < n; i++)
+    {
+      const int x = src[i].x(), y = src[i].y();
+      dst[i] = QPoint(ox + x*sx, oy + y*sy);
+    }
+  }
+
+  inline void unmapPoints(const QPoint *src, QPoint *dst, int n) const
+  {
+    const double ox = offsetX, oy = offsetY, ix = invScaleX, iy = invScaleY;
+    for (int i = 0; i < n; i++)
+    {
+      const int x = src[i].x(), y = src[i].y();
+      dst[i] = QPoint((x - ox)*ix, (y - oy)*iy);
+    }
+  }
+
+  // fit whole image centered inside widget keeping aspect ratio
+  static inline ViewTransform fit(const QSize &imageSize, const QSize &widgetSize)
+  {
+    if (imageSize.isEmpty() || widgetSize.isEmpty()) return ViewTransform();
+
+    double imageRatio = (double)imageSize.width() / (double)imageSize.height();
+
+    int w = widgetSize.width(), h = widgetSize.height();
+    int iw = w, ih = h;
+    iw = ih*imageRatio;
+    if (w < iw)
+    {
+      iw = w;
+      ih = w*(1.0/imageRatio);
+    }
+
+    return ViewTransform(w/2 - iw/2, h/2 - ih/2,
+                         (double)iw / (double)imageSize.width(),
+                         (double)ih / (double)imageSize.height());
+  }
+};
@@ -0,0 +1,297 @@
+#include "benchmark.hpp"
+#include "mainwindow.hpp"
+#include "projectwriter.hpp"
+#include "rasterizer.hpp"
+#include "renderarea.hpp"
+#include "shapeindex.hpp"
+#include "shapestore.hpp"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonObject>
+#include <QPainter>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+
+Benchmark::Benchmark(const BenchmarkOptions &options) : options{options}
+{
+}
+
+void Benchmark::generate(ShapeStore &store, std::vector<Shape*> &shapes, int count, int maxVertices,
+                         QSize imageSize, quint32 seed)
+{
+  std::mt19937 rng(seed);
+  const int w = imageSize.width(), h = imageSize.height();
+  // shapes get smaller as project grows so overlap stays similar
+  const int extent = std::max(4, (int)(2.0 * std::sqrt((double)w * h / std::max(1, count))));
+
+  std::uniform_int_distribution<int> x(0, w - 1), y(0, h - 1), size(2, extent), kind(0, 9);
+  std::uniform_int_distribution<int> vertexCount(3, 32), channel(0, 255);
+  std::normal_distribution<double> step(0.0, extent / 8.0);
+
+  shapes.reserve(shapes.size() + count);
+  for (int i = 0; i < count; i++)
+  {
+    const int k = kind(rng);
+    ShapeType type = k < 3 ? ShapeType::Rectangle : k < 6 ? ShapeType::Circle : ShapeType::Polygon;
+    if (i == 0 && maxVertices > 0) type = ShapeType::Polygon;
+
+    const Vec2 position(x(rng), y(rng));
+    Shape *shape = store.create(type, position, Vec2(size(rng), size(rng)),
+                                Color(channel(rng), channel(rng), channel(rng)));
+    if (type == ShapeType::Polygon)
+    {
+      // random walk around position, largest polygon spans whole image
+      const int n = i == 0 ? std::max(3, maxVertices) : vertexCount(rng);
+      const double scale = i == 0 ? std::max(w, h) / (extent / 8.0 * std::sqrt((double)n)) : 1.0;
+      shape->vertices.reserve(n);
+      double vx = position.x, vy = position.y;
+      for (int v = 0; v < n; v++)
+      {
+        shape->vertices.append(QPoint(qBound(0, (int)vx, w - 1), qBound(0, (int)vy, h - 1)));
+        vx += step(rng) * scale;
+        vy += step(rng) * scale;
+      }
+    }
+    shape->restoreAnchor();
+    shapes.push_back(shape);
+  }
+}
+
+void Benchmark::measure(const QString &name, int shapes, qint64 vertices, qint64 bytes,
+                        const std::function<void()> &body, const std::function<void()> &setup)
+{
+  std::vector<qint64> times;
+  QElapsedTimer timer;
+  for (int i = 0; i < std::max(1, options.runs); i++)
+  {
+    if (setup) setup();
+    timer.start();
+    body();
+    times.push_back(timer.nsecsElapsed());
+  }
+  std::sort(times.begin(), times.end());
+
+  const qint64 median = times[times.size() / 2];
+  QJsonObject result;
+  result["name"] = name;
+  result["shapes"] = shapes;
+  result["vertices"] = (double)vertices;
+  result["runs"] = (int)times.size();
+  result["min_ns"] = (double)times.front();
+  result["median_ns"] = (double)median;
+  if (shapes > 0) result["ns_per_shape"] = (double)median / shapes;
+  if (bytes > 0)
+  {
+    result["bytes"] = (double)bytes;
+    result["mb_per_s"] = bytes / (1024.0*1024.0) / std::max(1e-9, median / 1e9);
+  }
+  cases.append(result);
+
+  qDebug("%-24s %8d shapes %10.3f ms (min %.3f ms)", name.toStdString().c_str(), shapes, median / 1e6, times.front() / 1e6);
+}
+
+bool Benchmark::waitForImage(MainWindow &window)
+{
+  QEventLoop loop;
+  bool loaded = false;
+  RenderArea *area = window.getArea();
+  QObject::connect(area, &RenderArea::loadProgress, &loop, [&](int percent, const QString&)
+  {
+    if (percent < 100) return;
+    loaded = true;
+    loop.quit();
+  });
+  QObject::connect(area, &RenderArea::loadFailed, &loop, &QEventLoop::quit);
+  QTimer::singleShot(60*1000, &loop, &QEventLoop::quit);
+  loop.exec();
+  return loaded;
+}
+
+bool Benchmark::runProject(int count, const QString &dir)
+{
+  const QSize imageSize(options.imageSize, options.imageSize);
+  const QString imageFile = dir + "/image.bmp";
+  const QString projectFile = dir + QString("/project-%1.gk2").arg(count);
+
+  ShapeStore store;
+  std::vector<Shape*> shapes;
+  generate(store, shapes, count, options.maxVertices, imageSize, (quint32)count);
+
+  qint64 vertices = 0;
+  for (const auto s : shapes)
+    vertices += s->vertices.size();
+
+  // serializeShape / deserializeShape
+  for (int version = 1; version <= 2; version++)
+  {
+    QByteArray encoded;
+    measure(QString("serialize_v%1").arg(version), count, vertices,
+            ProjectWriter::encodedSize(imageFile.toStdString(), shapes, version),
+            [&]() { encoded = ProjectWriter::encode(imageFile.toStdString(), shapes, version); });
+
+    // records only, header is skipped
+    const size_t offset = ProjectWriter::encodedSize(imageFile.toStdString(), {}, version);
+    std::unique_ptr<ShapeStore> parsed;
+    measure(QString("deserialize_v%1").arg(version), count, vertices, encoded.size() - offset,
+            [&]()
+            {
+              const uint8_t *data = (const uint8_t*)encoded.constData();
+              size_t p = offset, size = encoded.size();
+              while (p < size)
+              {
+                Shape *shape = parsed->create();
+                size_t dp = version == 1 ? RenderArea::deserializeShape((const int8_t*)(data+p), size-p, *shape)
+                                         : RenderArea::deserializeShapeV2(data+p, size-p, *shape);
+                if (dp == 0) break;
+                p += dp;
+                shape->restoreAnchor();
+              }
+            },
+            [&]() { parsed.reset(new ShapeStore()); });
+  }
+
+  // label mask of whole image, scanline rasterizer against aliased QPainter fill
+  std::vector<uint8_t> mask;
+  measure("rasterize_spans", count, vertices, 0, [&]()
+  {
+    const QRect clip(QPoint(0, 0), imageSize);
+    std::vector<Span> spans;
+    for (const auto s : shapes)
+    {
+      spans.clear();
+      Rasterizer::shapeSpans(s, clip, spans);
+      Rasterizer::fill(mask.data(), imageSize.width(), QPoint(0, 0), spans, (uint8_t)s->type + 1);
+    }
+  },
+  [&]() { mask.assign((size_t)imageSize.width() * imageSize.height(), 0); });
+
+  QImage canvas(imageSize, QImage::Format_RGB32);
+  measure("rasterize_qpainter", count, vertices, 0, [&]()
+  {
+    QPainter painter(&canvas);
+    painter.setPen(Qt::NoPen);
+    for (const auto s : shapes)
+    {
+      painter.setBrush(QColor((int)s->type + 1, 0, 0));
+      const QPoint pos(s->position.x, s->position.y);
+      if (s->type == ShapeType::Circle)
+        painter.drawEllipse(QRect(pos.x() - s->size.x/2, pos.y() - s->size.y/2, s->size.x, s->size.y));
+      else if (s->type == ShapeType::Rectangle)
+        painter.drawRect(QRect(pos.x(), pos.y(), s->size.x/2, s->size.y/2));
+      else if (s->type == ShapeType::Polygon)
+        painter.drawPolygon(s->vertices.constData(), s->vertices.size(), Qt::OddEvenFill);
+    }
+  },
+  [&]() { canvas.fill(Qt::black); });
+
+  // loadProjectFile, journal and image loading included as far as they block
+  const QByteArray project = ProjectWriter::encode(imageFile.toStdString(), shapes);
+  if (!ProjectWriter::save(projectFile, project))
+  {
+    qDebug("Cannot write %s!", projectFile.toStdString().c_str());
+    return false;
+  }
+
+  MainWindow window;
+  bool loaded = true;
+  measure("load_project", count, vertices, project.size(),
+          [&]() { loaded &= window.loadProjectFile(projectFile); });
+  if (!loaded || !waitForImage(window))
+  {
+    qDebug("Cannot load %s!", projectFile.toStdString().c_str());
+    return false;
+  }
+
+  // offscreen paintEvent of whole view and of zoomed in part, both fast pass
+  // shown right after view change and high quality one which follows it
+  RenderArea *area = window.getArea();
+  area->resize(BENCHMARK_VIEW_SIZE);
+  QImage target(BENCHMARK_VIEW_SIZE, QImage::Format_ARGB32_Premultiplied);
+  const QPoint center(BENCHMARK_VIEW_SIZE.width()/2, BENCHMARK_VIEW_SIZE.height()/2);
+  auto render = [&]() { area->render(&target); };
+  // first render delivers pending resize event of hidden widget
+  render();
+
+  measure("paint_fit_fast", count, vertices, 0, render, [&]() { area->resetView(); });
+  measure("paint_fit", count, vertices, 0, render, [&]() { area->resetView(); area->endInteraction(); });
+  measure("paint_zoom_fast", count, vertices, 0, render, [&]() { area->resetView(); area->zoomAt(center, 8.0); });
+  measure("paint_zoom", count, vertices, 0, render,
+          [&]() { area->resetView(); area->zoomAt(center, 8.0); area->endInteraction(); });
+  area->resetView();
+
+  // hit-testing as done on mouse press, with bounds RenderArea keeps for shapes
+  ShapeIndex index;
+  for (const auto s : shapes)
+  {
+    s->imageBounds = area->computeImageBounds(s);
+    s->imageBoundsValid = true;
+    index.insert(s, s->imageBounds);
+  }
+
+  std::mt19937 rng(count);
+  std::uniform_int_distribution<int> x(0, imageSize.width() - 1), y(0, imageSize.height() - 1);
+  std::vector<QPoint> queries(BENCHMARK_QUERIES);
+  for (auto &q : queries)
+    q = QPoint(x(rng), y(rng));
+
+  int hits = 0;
+  measure("hit_vertex", count, vertices, 0, [&]()
+  {
+    VertexRef vertex;
+    for (const auto &q : queries)
+      hits += index.nearestVertex(q, VERTEX_SIZE, vertex);
+  });
+  measure("hit_shape", count, vertices, 0, [&]()
+  {
+    for (const auto &q : queries)
+      hits += index.pick(q) != nullptr;
+  });
+  qDebug("%d hits in %d queries.", hits, BENCHMARK_QUERIES * std::max(1, options.runs) * 2);
+
+  return true;
+}
+
+bool Benchmark::run()
+{
+  QTemporaryDir dir;
+  if (!dir.isValid()) return false;
+
+  // gradient is cheap to decode but not uniform for scaling
+  QImage image(options.imageSize, options.imageSize, QImage::Format_RGB32);
+  for (int y = 0; y < image.height(); y++)
+  {
+    QRgb *line = (QRgb*)image.scanLine(y);
+    for (int x = 0; x < image.width(); x++)
+      line[x] = qRgb(x & 0xff, y & 0xff, (x ^ y) & 0xff);
+  }
+  if (!image.save(dir.path() + "/image.bmp"))
+    return false;
+
+  // rasterizer timings are meaningful only while its masks are exact
+  rasterizerExact = Rasterizer::verify(BENCHMARK_SEED);
+  bool ok = rasterizerExact;
+  for (const auto count : options.shapeCounts)
+    ok &= runProject(count, dir.path());
+  return ok;
+}
+
+QJsonDocument Benchmark::results() const
+{
+  QJsonObject root;
+  root["qt"] = qVersion();
+  root["threads"] = QThread::idealThreadCount();
+  root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+  root["image_size"] = options.imageSize;
+  root["max_vertices"] = options.maxVertices;
+  root["rasterizer_exact"] = rasterizerExact;
+  root["cases"] = cases;
+  return QJsonDocument(root);
+}
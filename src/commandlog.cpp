@@ -0,0 +1,95 @@
+#include "commandlog.hpp"
+
+bool Command::merge(const Command &next)
+{
+  if (!open || next.type != type || next.shapeId != shapeId) return false;
+
+  switch (type)
+  {
+    case CommandType::MoveOrigin:
+      delta += next.delta;
+      verticesDelta += next.verticesDelta;
+      return true;
+    case CommandType::MoveVertex:
+      if (next.vertex != vertex) return false;
+      delta += next.delta;
+      sizeDelta += next.sizeDelta;
+      return true;
+    default:
+      return false;
+  }
+}
+
+void CommandLog::push(Command command)
+{
+  for (const auto &c : redoStack)
+    used -= c.bytes();
+  redoStack.clear();
+
+  if (!undoStack.empty() && undoStack.back().merge(command)) return;
+
+  // previous drag is over once other command comes
+  if (!undoStack.empty()) undoStack.back().open = false;
+
+  used += command.bytes();
+  undoStack.push_back(std::move(command));
+  trim();
+}
+
+void CommandLog::seal()
+{
+  if (!undoStack.empty()) undoStack.back().open = false;
+}
+
+void CommandLog::clear()
+{
+  undoStack.clear();
+  redoStack.clear();
+  used = 0;
+}
+
+void CommandLog::setBudget(size_t bytes)
+{
+  budget = bytes;
+  trim();
+}
+
+void CommandLog::trim()
+{
+  // newest step is kept even when it alone is over budget
+  while (used > budget && undoStack.size() > 1)
+  {
+    used -= undoStack.front().bytes();
+    undoStack.pop_front();
+  }
+}
+
+Command CommandLog::takeUndo()
+{
+  seal();
+  Command command = std::move(undoStack.back());
+  undoStack.pop_back();
+  used -= command.bytes();
+  return command;
+}
+
+void CommandLog::undone(Command command)
+{
+  used += command.bytes();
+  redoStack.push_back(std::move(command));
+}
+
+Command CommandLog::takeRedo()
+{
+  Command command = std::move(redoStack.back());
+  redoStack.pop_back();
+  used -= command.bytes();
+  return command;
+}
+
+void CommandLog::redone(Command command)
+{
+  used += command.bytes();
+  undoStack.push_back(std::move(command));
+  trim();
+}
@@ -0,0 +1,92 @@
+#include "imageloader.hpp"
+#include "imagepyramid.hpp"
+
+#include <QCoreApplication>
+#include <QImageReader>
+#include <QPointer>
+#include <QtConcurrent>
+
+#include <functional>
+
+// pixels are sampled directly (eg. region statistics), so only 32-bit formats are handed out
+static QImage to32Bit(const QImage &image)
+{
+  if (image.isNull() || image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32)
+    return image;
+  return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+}
+
+ImageLoader::ImageLoader(QObject *parent) : QObject(parent), generation{std::make_shared<std::atomic<int>>(0)}
+{
+}
+
+ImageLoader::~ImageLoader()
+{
+  cancel();
+}
+
+void ImageLoader::cancel()
+{
+  (*generation)++;
+}
+
+bool ImageLoader::load(const QString &fileName, QSize previewSize)
+{
+  // only header is read here
+  QImageReader reader(fileName);
+  if (!reader.canRead()) return false;
+  QSize fullSize = reader.size();
+
+  std::shared_ptr<std::atomic<int>> current = generation;
+  int gen = ++(*current);
+  auto stale = [current, gen] { return current->load() != gen; };
+
+  // results are handed to GUI thread through queued calls, dropped once loader is gone
+  QPointer<ImageLoader> self(this);
+  auto post = [self](std::function<void()> f)
+  {
+    QMetaObject::invokeMethod(QCoreApplication::instance(), [self, f] { if (self) f(); }, Qt::QueuedConnection);
+  };
+
+  QtConcurrent::run([=]
+  {
+    post([=]{ if (!stale()) emit progress(0, tr("Decoding preview...")); });
+
+    bool downscale = fullSize.isValid() && previewSize.isValid() &&
+      (fullSize.width() > previewSize.width() || fullSize.height() > previewSize.height());
+
+    QImage image;
+    if (downscale)
+    {
+      QImageReader previewReader(fileName);
+      previewReader.setScaledSize(fullSize.scaled(previewSize, Qt::KeepAspectRatio));
+      QImage preview = to32Bit(previewReader.read());
+      if (stale()) return;
+
+      if (!preview.isNull())
+      {
+        post([=]{ if (!stale()) emit previewLoaded(preview, fullSize); });
+      }
+      post([=]{ if (!stale()) emit progress(10, tr("Decoding full resolution image...")); });
+    }
+
+    // small images are decoded once in full resolution
+    QImageReader fullReader(fileName);
+    image = to32Bit(fullReader.read());
+    if (stale()) return;
+
+    if (image.isNull())
+    {
+      post([=]{ if (!stale()) emit failed(fileName); });
+      return;
+    }
+
+    post([=]{ if (!stale()) emit progress(70, tr("Building image pyramid...")); });
+    std::vector<QImage> levels = ImagePyramid::buildLevels(image);
+    if (stale()) return;
+
+    post([=]{ if (stale()) return; emit imageLoaded(image, levels); emit progress(100, tr("Image loaded.")); });
+  });
+
+  return true;
+}
@@ -0,0 +1,137 @@
+#include "imagepyramid.hpp"
+
+#include <cmath>
+
+ImagePyramid::ImagePyramid()
+{
+  tiles.setMaxCost(TILE_CACHE_BUDGET);
+}
+
+QSize ImagePyramid::halved(QSize size)
+{
+  return QSize(std::max(1, size.width()/2), std::max(1, size.height()/2));
+}
+
+std::vector<QImage> ImagePyramid::buildLevels(const QImage &image)
+{
+  std::vector<QImage> result;
+  if (image.isNull()) return result;
+
+  // level 0 shares data with source image
+  result.push_back(image);
+  QSize size = image.size();
+  while (size.width() > TILE_SIZE || size.height() > TILE_SIZE)
+  {
+    size = halved(size);
+    if ((qint64)size.width() * size.height() > PYRAMID_RESIDENT_PIXELS)
+    {
+      result.push_back(QImage());
+      continue;
+    }
+
+    // first resident level is scaled from source, following ones from previous level
+    const QImage &prev = result.back().isNull() ? image : result.back();
+    QImage level = prev.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    result.push_back(level);
+  }
+  return result;
+}
+
+void ImagePyramid::setLevels(std::vector<QImage> levels, QSize imageSize)
+{
+  clear();
+  this->levels = std::move(levels);
+  this->imageSize = imageSize;
+
+  for (size_t i = 0; i < this->levels.size(); i++)
+    levelSizes.push_back(i == 0 ? this->levels[0].size() : halved(levelSizes.back()));
+}
+
+void ImagePyramid::clear()
+{
+  levels.clear();
+  levelSizes.clear();
+  imageSize = QSize();
+  tiles.clear();
+}
+
+int ImagePyramid::levelForScale(double scale) const
+{
+  if (levels.empty() || scale <= 0.0) return 0;
+
+  // levels of preview are already smaller than image
+  scale *= (double)imageSize.width() / (double)levels[0].width();
+
+  int level = (int)std::floor(std::log2(1.0 / scale));
+  return std::max(0, std::min(level, levelCount() - 1));
+}
+
+QImage ImagePyramid::tile(int level, int tx, int ty)
+{
+  quint64 key = ((quint64)level << 48) | ((quint64)ty << 24) | (quint64)tx;
+  QImage *cached = tiles.object(key);
+  if (cached) return *cached;
+
+  const QImage &src = levels[0];
+  const QSize size = levelSizes[level];
+  QRect r = QRect(tx*TILE_SIZE, ty*TILE_SIZE, TILE_SIZE, TILE_SIZE) & QRect(QPoint(0, 0), size);
+
+  // matching part of source is scaled in place, without copying it first
+  double sx = (double)src.width() / size.width(), sy = (double)src.height() / size.height();
+  QRect s = QRect(QPoint((int)std::floor(r.left()*sx), (int)std::floor(r.top()*sy)),
+                  QPoint((int)std::ceil((r.right() + 1)*sx) - 1, (int)std::ceil((r.bottom() + 1)*sy) - 1)) & src.rect();
+  QImage part = src.depth() % 8 == 0
+      ? QImage(src.constScanLine(s.top()) + s.left()*src.depth()/8, s.width(), s.height(), src.bytesPerLine(), src.format())
+      : src.copy(s);
+  part.setColorTable(src.colorTable());
+  QImage image = part.scaled(r.size(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+  // cache may drop tile right away when it does not fit budget
+  int cost = std::max(1, image.bytesPerLine() * image.height() / 1024);
+  tiles.insert(key, new QImage(image), cost);
+  return image;
+}
+
+void ImagePyramid::draw(QPainter &painter, const ViewTransform &view, const QRect &widgetRect)
+{
+  if (levels.empty()) return;
+
+  int level = levelForScale(view.scaleX);
+  const QSize size = levelSizes[level];
+
+  // level pixels per image pixel (halving floors sizes so use real ratio)
+  double lx = (double)size.width() / (double)imageSize.width();
+  double ly = (double)size.height() / (double)imageSize.height();
+
+  QRect visible = view.unmapRect(widgetRect).adjusted(-1, -1, 1, 1) & QRect(QPoint(0, 0), imageSize);
+  if (visible.isEmpty()) return;
+
+  // resident level is drawn in one piece
+  if (!levels[level].isNull())
+  {
+    QRectF target(view.offsetX + visible.x()*view.scaleX, view.offsetY + visible.y()*view.scaleY,
+                  visible.width()*view.scaleX, visible.height()*view.scaleY);
+    QRectF source(visible.x()*lx, visible.y()*ly, visible.width()*lx, visible.height()*ly);
+    painter.drawImage(target, levels[level], source);
+    return;
+  }
+
+  int tx0 = (int)(visible.left() * lx) / TILE_SIZE;
+  int ty0 = (int)(visible.top() * ly) / TILE_SIZE;
+  int tx1 = std::min((int)(visible.right() * lx) / TILE_SIZE, (size.width() - 1) / TILE_SIZE);
+  int ty1 = std::min((int)(visible.bottom() * ly) / TILE_SIZE, (size.height() - 1) / TILE_SIZE);
+
+  for (int ty = ty0; ty <= ty1; ty++)
+  {
+    for (int tx = tx0; tx <= tx1; tx++)
+    {
+      QImage image = tile(level, tx, ty);
+
+      // tile rectangle in image space mapped to widget space
+      double ix = tx*TILE_SIZE / lx, iy = ty*TILE_SIZE / ly;
+      QRectF target(view.offsetX + ix*view.scaleX, view.offsetY + iy*view.scaleY,
+                    image.width() / lx * view.scaleX, image.height() / ly * view.scaleY);
+      painter.drawImage(target, image, QRectF(image.rect()));
+    }
+  }
+}
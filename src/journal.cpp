@@ -0,0 +1,350 @@
+#include "journal.hpp"
+#include "renderarea.hpp"
+#include "projectwriter.hpp"
+#include "shapestore.hpp"
+#include "varint.hpp"
+
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#define JOURNAL_HEADER_SIZE (4 + 1 + 4*2 + 2 + 4)
+#define JOURNAL_RECORD_HEADER_SIZE (1 + 4*3)
+
+static inline void writeU16LE(uint8_t *out, uint16_t v)
+{
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t readU16LE(const uint8_t *in)
+{
+  return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static QByteArray encodeHeader(const std::vector<quint32> &ids, const QByteArray &project)
+{
+  QByteArray b(JOURNAL_HEADER_SIZE + 4*ids.size(), Qt::Uninitialized);
+  uint8_t *data = (uint8_t*)b.data();
+
+  const quint64 projectSize = project.size();
+  memcpy(data, "GK2J", 4);
+  data[4] = JOURNAL_VERSION;
+  writeU32LE(data+5, (uint32_t)projectSize);
+  writeU32LE(data+9, (uint32_t)(projectSize >> 32));
+  writeU16LE(data+13, qChecksum(project.constData(), project.size()));
+  writeU32LE(data+15, (uint32_t)ids.size());
+
+  uint8_t *p = data + JOURNAL_HEADER_SIZE;
+  for (const auto id : ids)
+  {
+    writeU32LE(p, id);
+    p += 4;
+  }
+  return b;
+}
+
+static bool appendFile(const QString &fileName, const QByteArray &data)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) return false;
+  return file.write(data) == data.size() && ProjectWriter::sync(file);
+}
+
+Journal::Journal(RenderArea *area, const QString &projectFile, QObject *parent)
+  : QObject(parent), area{area}, projectFile{projectFile}, journalFile{fileNameFor(projectFile)}
+{
+  flushTimer.setSingleShot(true);
+  flushTimer.setInterval(JOURNAL_FLUSH_DELAY);
+  connect(&flushTimer, &QTimer::timeout, this, &Journal::flush);
+
+  compactTimer.setInterval(JOURNAL_COMPACT_INTERVAL);
+  connect(&compactTimer, &QTimer::timeout, this, [this]()
+  {
+    if (changedSinceCompaction) compact();
+  });
+  compactTimer.start();
+
+  connect(area, &RenderArea::shapeInserted, this, &Journal::shapeInserted);
+  connect(area, &RenderArea::shapeAboutToBeRemoved, this, &Journal::shapeAboutToBeRemoved);
+  connect(area, &RenderArea::shapeModified, this, &Journal::shapeModified);
+}
+
+void Journal::start(bool compactNow)
+{
+  if (compactNow)
+    compact();
+  else
+    restart(nullptr);
+}
+
+void Journal::close()
+{
+  flush();
+  disconnect(area, nullptr, this, nullptr);
+  flushTimer.stop();
+  compactTimer.stop();
+
+  // queued after all writes of this journal, their signals are still delivered
+  QtConcurrent::run(writer(), [this]() { QMetaObject::invokeMethod(this, "deleteLater", Qt::QueuedConnection); });
+}
+
+QThreadPool *Journal::writer()
+{
+  static QThreadPool *pool = nullptr;
+  if (!pool)
+  {
+    pool = new QThreadPool();
+    pool->setMaxThreadCount(1);
+    pool->setExpiryTimeout(-1);
+  }
+  return pool;
+}
+
+void Journal::waitForWrites()
+{
+  writer()->waitForDone();
+}
+
+QString Journal::fileNameFor(const QString &projectFile)
+{
+  return projectFile + JOURNAL_SUFFIX;
+}
+
+void Journal::appendRecord(QByteArray &out, Op op, quint32 id, quint32 row, const Shape *shape)
+{
+  const size_t payload = shape ? RenderArea::serializedShapeSize(shape) : 0;
+  const int start = out.size();
+  out.resize(start + JOURNAL_RECORD_HEADER_SIZE + payload + 2);
+
+  uint8_t *data = (uint8_t*)out.data() + start;
+  data[0] = op;
+  writeU32LE(data+1, id);
+  writeU32LE(data+5, row);
+  writeU32LE(data+9, (uint32_t)payload);
+  if (shape)
+    RenderArea::serializeShape(shape, (int8_t*)data + JOURNAL_RECORD_HEADER_SIZE);
+
+  const size_t size = JOURNAL_RECORD_HEADER_SIZE + payload;
+  writeU16LE(data+size, qChecksum((const char*)data, (uint)size));
+}
+
+void Journal::shapeInserted(int row)
+{
+  const Shape *shape = area->getShapes()[row];
+  appendRecord(pending, Create, shape->id, row, shape);
+  schedule();
+}
+
+void Journal::shapeAboutToBeRemoved(int row)
+{
+  const quint32 id = area->getShapes()[row]->id;
+  modified.remove(id);
+  appendRecord(pending, Delete, id, row, nullptr);
+  schedule();
+}
+
+void Journal::shapeModified(Shape *shape)
+{
+  // drag updates only mark shape, its state is taken once per batch
+  modified.insert(shape->id);
+  schedule();
+}
+
+void Journal::schedule()
+{
+  changedSinceCompaction = true;
+  if (!flushTimer.isActive()) flushTimer.start();
+}
+
+void Journal::flush()
+{
+  flushTimer.stop();
+
+  for (const auto id : modified)
+  {
+    const Shape *shape = area->findShape(id);
+    if (shape) appendRecord(pending, Modify, id, 0, shape);
+  }
+  modified.clear();
+
+  if (pending.isEmpty()) return;
+
+  QByteArray batch;
+  batch.swap(pending);
+  journalSize += batch.size();
+
+  const QString fileName = journalFile;
+  QtConcurrent::run(writer(), [this, fileName, batch]()
+  {
+    if (!appendFile(fileName, batch))
+      emit failed(tr("Cannot write journal %1!").arg(fileName));
+  });
+
+  if (journalSize > JOURNAL_COMPACT_SIZE) compact();
+}
+
+void Journal::compact()
+{
+  flushTimer.stop();
+  pending.clear();
+  modified.clear();
+  changedSinceCompaction = false;
+
+  // everything pending is part of snapshot, it is encoded by writer
+  restart(ProjectWriter::snapshot(area->fileName, area->getShapes()));
+}
+
+void Journal::discard()
+{
+  disconnect(area, nullptr, this, nullptr);
+  flushTimer.stop();
+  compactTimer.stop();
+  pending.clear();
+  modified.clear();
+  changedSinceCompaction = false;
+
+  // writes queued before are finished first
+  const QString fileName = journalFile;
+  QtConcurrent::run(writer(), [fileName]() { QFile::remove(fileName); });
+}
+
+/*
+ * Starts new journal for current shapes. With snapshot given it is written
+ * into project file first, otherwise project file is expected to match
+ * current shapes (just loaded). Project file is replaced before journal,
+ * journal left from before is then recognized by header. Records of later
+ * changes are queued behind on the same writer.
+ */
+void Journal::restart(std::shared_ptr<const ProjectSnapshot> snapshot)
+{
+  const auto &shapes = area->getShapes();
+  std::vector<quint32> ids(shapes.size());
+  std::transform(shapes.begin(), shapes.end(), ids.begin(), [](const Shape *s) { return s->id; });
+
+  const QString projectName = projectFile, fileName = journalFile;
+  QtConcurrent::run(writer(), [this, snapshot, ids, projectName, fileName]()
+  {
+    QByteArray contents;
+    if (snapshot)
+    {
+      QElapsedTimer timer;
+      timer.start();
+      contents = ProjectWriter::encode(snapshot->imageName, snapshot->shapes);
+      if (!ProjectWriter::save(projectName, contents))
+      {
+        emit saveFailed(projectName);
+        return;
+      }
+      emit saved(projectName, contents.size(), (int)snapshot->shapes.size(), timer.nsecsElapsed() / 1e9);
+    }
+    else
+    {
+      QFile file(projectName);
+      if (!file.open(QIODevice::ReadOnly))
+      {
+        emit failed(tr("Cannot read project %1!").arg(projectName));
+        return;
+      }
+      contents = file.readAll();
+    }
+
+    QSaveFile file(fileName);
+    QByteArray header = encodeHeader(ids, contents);
+    if (!file.open(QIODevice::WriteOnly) || file.write(header) != header.size()
+        || !ProjectWriter::sync(file) || !file.commit())
+      emit failed(tr("Cannot write journal %1!").arg(fileName));
+  });
+
+  journalSize = JOURNAL_HEADER_SIZE + 4*ids.size();
+}
+
+int Journal::replay(const QString &projectFile, ShapeStore &store, std::vector<Shape*> &shapes)
+{
+  QFile file(fileNameFor(projectFile));
+  if (!file.open(QIODevice::ReadOnly)) return 0;
+  const QByteArray journal = file.readAll();
+  const uint8_t *data = (const uint8_t*)journal.constData();
+  const size_t size = journal.size();
+
+  if (size < JOURNAL_HEADER_SIZE || memcmp(data, "GK2J", 4) != 0 || data[4] != JOURNAL_VERSION)
+    return -1;
+
+  QFile projectData(projectFile);
+  if (!projectData.open(QIODevice::ReadOnly)) return -1;
+  const QByteArray project = projectData.readAll();
+
+  const quint64 projectSize = readU32LE(data+5) | ((quint64)readU32LE(data+9) << 32);
+  const size_t count = readU32LE(data+15);
+  if (projectSize != (quint64)project.size()
+      || readU16LE(data+13) != qChecksum(project.constData(), project.size())
+      || count != shapes.size() || count > (size - JOURNAL_HEADER_SIZE) / 4)
+  {
+    qDebug("Journal %s does not match project file.", file.fileName().toStdString().c_str());
+    return -1;
+  }
+
+  // journal ids are from session that wrote it
+  QHash<quint32, Shape*> byId;
+  byId.reserve((int)count);
+  size_t p = JOURNAL_HEADER_SIZE;
+  for (size_t i = 0; i < count; i++, p += 4)
+    byId.insert(readU32LE(data+p), shapes[i]);
+
+  int applied = 0;
+  while (size - p >= JOURNAL_RECORD_HEADER_SIZE + 2)
+  {
+    const uint8_t *record = data + p;
+    const uint8_t op = record[0];
+    const quint32 id = readU32LE(record+1);
+    const size_t row = readU32LE(record+5);
+    const size_t payload = readU32LE(record+9);
+    if (payload > size - p - JOURNAL_RECORD_HEADER_SIZE - 2) break;
+
+    const size_t recordSize = JOURNAL_RECORD_HEADER_SIZE + payload;
+    if (readU16LE(record+recordSize) != qChecksum((const char*)record, (uint)recordSize))
+      break; // torn write of last batch
+
+    const int8_t *shapeData = (const int8_t*)(record + JOURNAL_RECORD_HEADER_SIZE);
+    if (op == Create)
+    {
+      Shape *shape = store.create();
+      if (byId.contains(id) || RenderArea::deserializeShape(shapeData, payload, *shape) == 0)
+      {
+        store.destroy(shape);
+        break;
+      }
+      shape->restoreAnchor();
+      shapes.insert(shapes.begin() + std::min(row, shapes.size()), shape);
+      byId.insert(id, shape);
+    }
+    else if (op == Modify)
+    {
+      Shape *shape = byId.value(id);
+      if (!shape || RenderArea::deserializeShape(shapeData, payload, *shape) == 0) break;
+      shape->restoreAnchor();
+      shape->imageBoundsValid = false;
+    }
+    else if (op == Delete)
+    {
+      Shape *shape = byId.take(id);
+      if (!shape) break;
+      auto it = row < shapes.size() && shapes[row] == shape ? shapes.begin() + row
+                                                           : std::find(shapes.begin(), shapes.end(), shape);
+      shapes.erase(it);
+      store.destroy(shape);
+    }
+    else break;
+
+    p += recordSize + 2;
+    applied++;
+  }
+
+  if (p != size)
+    qDebug("Journal replay stopped at offset %zu of %zu.", p, size);
+  return applied;
+}
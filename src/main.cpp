@@ -1,15 +1,116 @@
 #include <QtGui>
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCoreApplication>
 #include <QLabel>
 #include <QMessageBox>
 #include <QString>
 #include <QMainWindow>
+#include <QThread>
 
 #include "mainwindow.hpp"
 #include "renderarea.hpp"
+#include "maskrenderer.hpp"
+#include "benchmark.hpp"
+
+// headless mode: CGPicker --render-masks [--instances] [-j N] -o out/ in/*.gk2
+static int renderMasks(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Rasterizes shapes of GK2 projects into label masks.");
+  parser.addHelpOption();
+  parser.addOption(QCommandLineOption("render-masks", "Render masks instead of opening window."));
+  parser.addOption(QCommandLineOption({"o", "output"}, "Output directory.", "dir", "."));
+  parser.addOption(QCommandLineOption("instances", "Write 16-bit instance masks (PGM) instead of 8-bit label masks (PNG)."));
+  parser.addOption(QCommandLineOption({"j", "jobs"}, "Number of threads.", "n", QString::number(QThread::idealThreadCount())));
+  parser.addPositionalArgument("projects", "Project files (*.gk2).", "projects...");
+  parser.process(app);
+
+  QStringList projects = parser.positionalArguments();
+  if (projects.isEmpty())
+  {
+    parser.showHelp(1);
+  }
+
+  QString outputDir = parser.value("output");
+  if (!QDir().mkpath(outputDir))
+  {
+    qDebug("Cannot create output directory %s!", outputDir.toStdString().c_str());
+    return 1;
+  }
+
+  MaskMode mode = parser.isSet("instances") ? MaskMode::Instance : MaskMode::Label;
+  int jobs = std::max(1, parser.value("jobs").toInt());
+
+  int failed = MaskRenderer::renderAll(projects, outputDir, mode, jobs);
+  printf("Rendered %d of %d projects.\n", projects.size() - failed, projects.size());
+  return failed > 0 ? 1 : 0;
+}
+
+// benchmark mode: CGPicker --benchmark [--shapes 1000,10000] [--vertices N] [--runs N] [-o results.json]
+static int runBenchmark(int argc, char *argv[])
+{
+  // runs on headless machines unless platform is chosen explicitly
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+
+  BenchmarkOptions options;
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Times project I/O, painting and hit-testing on synthetic projects.");
+  parser.addHelpOption();
+  parser.addOption(QCommandLineOption("benchmark", "Run benchmarks instead of opening window."));
+  parser.addOption(QCommandLineOption("shapes", "Comma separated shape counts of projects.", "counts", "1000,10000,100000,1000000"));
+  parser.addOption(QCommandLineOption("vertices", "Vertices of largest polygon.", "n", QString::number(options.maxVertices)));
+  parser.addOption(QCommandLineOption("runs", "Runs of every case.", "n", QString::number(options.runs)));
+  parser.addOption(QCommandLineOption("image-size", "Side of synthetic image.", "px", QString::number(options.imageSize)));
+  parser.addOption(QCommandLineOption({"o", "output"}, "JSON results file, standard output when not set.", "file"));
+  parser.process(app);
+
+  options.shapeCounts.clear();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+  const auto skipEmpty = Qt::SkipEmptyParts;
+#else
+  const auto skipEmpty = QString::SkipEmptyParts;
+#endif
+  for (const auto &count : parser.value("shapes").split(',', skipEmpty))
+    options.shapeCounts.push_back(std::max(1, count.toInt()));
+  options.maxVertices = std::max(0, parser.value("vertices").toInt());
+  options.runs = std::max(1, parser.value("runs").toInt());
+  options.imageSize = std::max(16, parser.value("image-size").toInt());
+
+  Benchmark benchmark(options);
+  bool ok = benchmark.run();
+
+  QByteArray json = benchmark.results().toJson();
+  if (parser.isSet("output"))
+  {
+    QFile file(parser.value("output"));
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+    {
+      qDebug("Cannot write %s!", file.fileName().toStdString().c_str());
+      return 1;
+    }
+  }
+  else
+  {
+    fwrite(json.constData(), 1, json.size(), stdout);
+  }
+  return ok ? 0 : 1;
+}
 
 int main(int argc, char *argv[]) 
 {
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--render-masks") == 0)
+      return renderMasks(argc, argv);
+    if (strcmp(argv[i], "--benchmark") == 0)
+      return runBenchmark(argc, argv);
+  }
+
   QApplication app(argc, argv);
   MainWindow window;
 
@@ -3,24 +3,17 @@
 
 #include "mainwindow.hpp"
 #include "renderarea.hpp"
+#include "projectwriter.hpp"
+#include "projectreader.hpp"
+#include "shapelistmodel.hpp"
+#include "journal.hpp"
 
 #define BUTTON_SIZE 128
 
-std::map<ShapeType, QString> shapeNames = { 
-  { ShapeType::Polygon, "Polygon" }, 
-  { ShapeType::Circle, "Circle" }, 
-  { ShapeType::Rectangle, "Rectangle" } 
-};
-
-
-ShapeItem::ShapeItem(Shape *shape) : QListWidgetItem()
-{
-  this->shape = shape;
-  setText(shapeNames.at(shape->type));
-}
-
 MainWindow::MainWindow()
 {
+  eyedropperSize = EYEDROPPER_SIZE;
+  journal = nullptr;
   createMenus();
  
   QWidget *mainWidget = new QWidget;
@@ -50,21 +43,30 @@ MainWindow::MainWindow()
   buttonsLayout->addWidget(createButton(":/res/icons/circle.svg", "Circle", &MainWindow::selected, BARG(ToolType::Circle)));
   buttonsLayout->addWidget(createButton(":/res/icons/rectangle.svg", "Rectangle", &MainWindow::selected, BARG(ToolType::Rectangle) ));
   buttonsLayout->addWidget(createButton(":/res/icons/colors.svg", "Color", &MainWindow::selected, BARG(ToolType::Color) ));
+  buttonsLayout->addWidget(createButton(":/res/icons/eyedropper.svg", "Eyedropper", &MainWindow::selected, BARG(ToolType::Eyedropper) ));
   buttonsLayout->addStretch();
 
   allLayout->addLayout(buttonsLayout);
 
+  // shapes list model, rows are created only for visible shapes
+  this->shapesModel = new ShapeListModel(this);
+
   // central view
   this->area = new RenderArea(this);
   area->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+  connectArea();
   allLayout->addWidget(area);
    
   // shapes list
-  this->shapesList = new QListWidget(this);
+  shapesModel->setArea(area);
+  this->shapesList = new QListView(this);
+  this->shapesList->setModel(shapesModel);
+  this->shapesList->setUniformItemSizes(true);
+  this->shapesList->setSelectionMode(QAbstractItemView::SingleSelection);
   this->shapesList->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Expanding);
   this->shapesList->setContextMenuPolicy(Qt::CustomContextMenu);
   connect(shapesList, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(showContextMenu(QPoint)));
-  connect(shapesList, SIGNAL(itemPressed(QListWidgetItem*)), this, SLOT(shapeSelected(QListWidgetItem*)) );
+  connect(shapesList, SIGNAL(pressed(QModelIndex)), this, SLOT(shapeSelected(QModelIndex)) );
   allLayout->addWidget(shapesList);
 
 
@@ -102,22 +104,86 @@ void MainWindow::createMenus()
   projectMenu->addAction(createAction("&Exit", &MainWindow::exit));
 
 
+  QMenu *editMenu = menuBar()->addMenu(tr("&Edit"));
+  undoAction = createAction("&Undo", &MainWindow::undo);
+  undoAction->setShortcut(QKeySequence::Undo);
+  undoAction->setEnabled(false);
+  editMenu->addAction(undoAction);
+  redoAction = createAction("&Redo", &MainWindow::redo);
+  redoAction->setShortcut(QKeySequence::Redo);
+  redoAction->setEnabled(false);
+  editMenu->addAction(redoAction);
+
   QMenu *dataMenu = menuBar()->addMenu(tr("&Data"));
   dataMenu->addAction(createAction("&Load image", &MainWindow::loadImage));
+  dataMenu->addAction(createAction("&Eyedropper size...", &MainWindow::setEyedropperSize));
+
+  QMenu *viewMenu = menuBar()->addMenu(tr("&View"));
+  viewMenu->addAction(createAction("&Fit to window", &MainWindow::fitToWindow));
+  latencyAction = createAction("&Latency overlay", &MainWindow::toggleLatencyOverlay);
+  latencyAction->setCheckable(true);
+  viewMenu->addAction(latencyAction);
 
   QMenu *helpMenu = menuBar()->addMenu(tr("&Help"));
   helpMenu->addAction(createAction("&About", &MainWindow::about));
 }
 
+MainWindow::~MainWindow()
+{
+  // journal is flushed while area still exists, writes end before exit
+  stopJournal();
+  Journal::waitForWrites();
+}
+
 void MainWindow::newProject()
 {
+  stopJournal();
+  shapesModel->setArea(nullptr);
   allLayout->removeWidget(this->area);
   delete this->area;
   this->area = new RenderArea(this);
   area->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
+  connectArea();
   allLayout->insertWidget(1, this->area);
 
-  shapesList->clear();
+  shapesModel->setArea(area);
+}
+
+void MainWindow::connectArea()
+{
+  connect(area, &RenderArea::loadProgress, this, &MainWindow::imageProgress);
+  connect(area, &RenderArea::loadFailed, this, &MainWindow::imageFailed);
+  connect(area, &RenderArea::statsChanged, this, [this](Shape *shape) { shapesModel->statsChanged(shape); });
+  connect(area, &RenderArea::colorPicked, this, &MainWindow::colorPicked);
+  connect(area, &RenderArea::shapeAboutToBeInserted, shapesModel, &ShapeListModel::beginInsertShape);
+  connect(area, &RenderArea::shapeInserted, shapesModel, &ShapeListModel::endInsertShape);
+  connect(area, &RenderArea::shapeAboutToBeRemoved, shapesModel, &ShapeListModel::beginRemoveShape);
+  connect(area, &RenderArea::shapeRemoved, shapesModel, &ShapeListModel::endRemoveShape);
+  connect(area, &RenderArea::historyChanged, this, &MainWindow::updateHistoryActions);
+  area->setEyedropperSize(eyedropperSize);
+  area->setLatencyOverlay(latencyAction->isChecked());
+  updateHistoryActions();
+}
+
+void MainWindow::startJournal(const QString &fileName, bool compactNow)
+{
+  stopJournal();
+  journal = new Journal(area, fileName, this);
+  connect(journal, &Journal::saved, this, &MainWindow::projectSaved);
+  connect(journal, &Journal::saveFailed, this, &MainWindow::projectSaveFailed);
+  connect(journal, &Journal::failed, this, [this](const QString &message)
+  {
+    qDebug("%s", message.toStdString().c_str());
+    statusBar()->showMessage(message);
+  });
+  journal->start(compactNow);
+}
+
+void MainWindow::stopJournal()
+{
+  // writes still queued finish in background
+  if (journal) journal->close();
+  journal = nullptr;
 }
 
 void MainWindow::loadProject()
@@ -137,123 +203,133 @@ void MainWindow::loadProject()
 
 bool MainWindow::loadProjectFile(QString fileName)
 {
-  QFile file(fileName);
-  if (!file.open(QFile::ReadOnly)) {
-    qDebug("Cannot read file %s!", fileName.toStdString().c_str() );
-    return false;
-  }
-    
-  QByteArray b = file.readAll();
-  file.close();
-  
-  qDebug("Data size: %d.\n", b.size());
-
-  if (b[0] != 'G' || b[1] != 'K' || b[2] != '2') 
+  // reopened project has to be read after its own queued writes
+  if (journal && QFileInfo(journal->getProjectFile()).absoluteFilePath() == QFileInfo(fileName).absoluteFilePath())
   {
-    qDebug("Magic not found!");
-    return false;
+    journal->flush();
+    Journal::waitForWrites();
   }
 
-  size_t fileNameSize = b.at(3);
-  QString imageName = b.data()+sizeof(char)*3+sizeof(int8_t);
-
-  if (imageName.size() + 1 != fileNameSize)
+  ProjectReader reader(fileName);
+  ShapeStore store;
+  std::vector<Shape*> shapes;
+  if (!reader.open() || !reader.readShapes(store, shapes))
   {
-    qDebug("Warning: Wrong file name sizes!");
+    qDebug("%s", reader.errorString().toStdString().c_str());
     return false;
   }
 
   this->newProject();
-  this->area->loadImage(imageName);
 
-  // MAGICSTR + SIZEOF(FILENAME) + FILENAME = DATA_OFFSET 
-  size_t p = sizeof(int8_t) + sizeof(char)*3 + fileNameSize*sizeof(char);
-  
-  while (p < b.size())
+  // changes not compacted into project file before last exit, project file is
+  // rewritten with them only when user wants them back
+  int replayed = Journal::replay(fileName, store, shapes);
+  if (replayed > 0 && QMessageBox::question(this, tr("Recover changes"),
+          tr("Journal of this project contains %1 unsaved changes. Recover them?").arg(replayed)) != QMessageBox::Yes)
   {
-    Shape *shape;
-    size_t dp = 0;
-    std::tie(shape, dp) = RenderArea::deserializeShape((int8_t*)(b.data()+p), b.size()-p);
-
-    p += dp;
-    
-    if (shape->type != ShapeType::Polygon)
+    store = ShapeStore();
+    shapes.clear();
+    replayed = 0;
+    if (!reader.readShapes(store, shapes))
     {
-      int vx = shape->position.x + shape->size.x/2;
-      int vy = shape->position.y + shape->size.y/2;
-      shape->vertices.append(QPoint(vx, vy));
+      qDebug("%s", reader.errorString().toStdString().c_str());
+      return false;
     }
-    area->addShape(shape);
-    this->addedShape(shape);
   }
+  this->area->loadImage(reader.imageName());
+
+  // list is told about all shapes at once
+  shapesModel->beginBulkLoad();
+  area->setShapes(std::move(store), shapes);
+  shapesModel->endBulkLoad();
+
+  startJournal(fileName, replayed > 0);
+  if (replayed > 0)
+    statusBar()->showMessage(tr("Recovered %1 changes from journal.").arg(replayed));
 
   return true;
 }
 
 void MainWindow::saveProject()
 {
-  auto shapes = area->getShapes();
- 
-  QByteArray b;
-  b.append("GK2"); // add magic
-  b.append(area->fileName.size()+1); //TODO: Allow file name > 255bytes
-  for (const auto c : area->fileName) {
-    b.append(c);
-  }
-  b.append((char)0);
-  
-  for (const auto s : shapes)
-  {
-    int8_t *data;
-    size_t size;
-
-    std::tie(data, size) = RenderArea::serializeShape(s);
-    for (size_t i = 0; i < size; i++) {
-      auto c = data[i];
-      b.append(c);
-    }
-    
-    delete[] data;
-  }
-
-  //qDebug("Data: %lu bytes (capacity=%lu).", theData.size(), theData.capacity());
-  //for (auto const d : theData) { qDebug("%4x (%c) ", d, (char)d); }
-
   QString fileName = QFileDialog::getSaveFileName(this, tr("Save File"),
                            ".",
                            tr("Project files (*.gk2)"));
+  if (fileName.isEmpty()) return;
 
-  QFile file(fileName);
-  if (file.open(QFile::WriteOnly)) {
-    file.write(b);
-  }
-  file.close();
+  // changes since last save belong to new file only, old project stays as it was saved
+  if (journal && QFileInfo(journal->getProjectFile()).absoluteFilePath() != QFileInfo(fileName).absoluteFilePath())
+    journal->discard();
 
-  qDebug("Saved %d bytes to %s.", b.size(), fileName.toStdString().c_str());
+  QElapsedTimer timer;
+  timer.start();
+  startJournal(fileName, true);
+  qDebug("Project snapshot of %zu shapes taken in %.2f ms.", area->getShapes().size(), timer.nsecsElapsed() / 1e6);
+  statusBar()->showMessage(tr("Saving project..."));
 }
 
-void MainWindow::addedShape(Shape *shape)
+void MainWindow::projectSaved(const QString &fileName, qint64 bytes, int shapes, double seconds)
 {
-  if (!shape) return;
+  // throughput of encoding and writing on writer thread
+  seconds = std::max(seconds, 1e-9);
+  double mbps = bytes / (1024.0*1024.0) / seconds;
+  qDebug("Saved %lld bytes to %s (%.2f ms, %.1f MB/s, %.0f shapes/s).",
+         (long long)bytes, fileName.toStdString().c_str(), seconds * 1e3, mbps, shapes / seconds);
+  statusBar()->showMessage(tr("Project saved (%1 shapes, %2 MB/s).").arg(shapes).arg(mbps, 0, 'f', 1));
+}
 
-  shapesList->addItem(new ShapeItem(shape));
+void MainWindow::projectSaveFailed(const QString &fileName)
+{
+  statusBar()->clearMessage();
+  QMessageBox::critical(this, tr("Cannot save file"),
+          tr("File \"<i>") + fileName + tr("</i>\" cannot be saved!"));
 }
 
-void MainWindow::deleteItem()
+void MainWindow::undo()
+{
+  area->undo();
+}
+
+void MainWindow::redo()
+{
+  area->redo();
+}
+
+void MainWindow::updateHistoryActions()
+{
+  undoAction->setEnabled(area->canUndo());
+  redoAction->setEnabled(area->canRedo());
+}
+
+void MainWindow::pickedShape(Shape *shape)
 {
-  for (int i = 0; i < shapesList->selectedItems().size(); ++i) {
-      QListWidgetItem *item = shapesList->takeItem(shapesList->currentRow());
-      auto shapeItem = dynamic_cast<ShapeItem*>(item);
-      area->deleteShape(shapeItem->shape);
-      delete item;
+  // keep list selection in sync with shape picked on canvas
+  int row = shapesModel->rowOf(shape);
+  if (row < 0)
+  {
+    shapesList->clearSelection();
+    return;
   }
+  shapesList->setCurrentIndex(shapesModel->index(row));
+}
+
+void MainWindow::deleteItem()
+{
+  QModelIndexList selected = shapesList->selectionModel()->selectedIndexes();
+  if (selected.isEmpty()) return;
+
+  int row = selected.first().row();
+  Shape *shape = shapesModel->shapeAt(row);
+  if (!shape) return;
+
+  area->deleteShape(shape);
 }
       
-void MainWindow::shapeSelected(QListWidgetItem *item)
+void MainWindow::shapeSelected(const QModelIndex &index)
 {
-  qDebug("Item %p selected.", item);
-  auto shapeItem = dynamic_cast<ShapeItem*>(item);
-  area->setSelected(shapeItem->shape);
+  Shape *shape = shapesModel->shapeAt(index.row());
+  qDebug("Shape %d. selected.", index.row());
+  if (shape) area->setSelected(shape);
 }
   
 void MainWindow::showContextMenu(const QPoint &pos)
@@ -275,15 +351,46 @@ void MainWindow::loadImage()
   
   if (!area->loadImage(imageName))
   {
-    QMessageBox::critical(this, tr("Error"),
-            tr("Image \"<i>") + imageName + tr("</i>\" cannot be loaded!"));
+    imageFailed(imageName);
   }
-  area->repaint();
+}
 
-  if (!area->getImage()->isNull())
-  {
-    statusBar()->showMessage(tr("Image loaded."));
-  }
+void MainWindow::setEyedropperSize()
+{
+  bool ok = false;
+  int size = QInputDialog::getInt(this, tr("Eyedropper"), tr("Averaged kernel size (NxN, odd):"),
+                                  eyedropperSize, 1, EYEDROPPER_MAX_SIZE, 2, &ok);
+  if (!ok) return;
+
+  area->setEyedropperSize(size);
+  eyedropperSize = area->getEyedropperSize();
+  statusBar()->showMessage(tr("Eyedropper samples %1x%1 pixels.").arg(eyedropperSize));
+}
+
+void MainWindow::colorPicked(const QColor &color)
+{
+  statusBar()->showMessage(tr("Color %1 picked.").arg(color.name()));
+}
+
+void MainWindow::imageProgress(int percent, const QString &message)
+{
+  statusBar()->showMessage(QString("%1 (%2%)").arg(message).arg(percent));
+}
+
+void MainWindow::imageFailed(const QString &fileName)
+{
+  QMessageBox::critical(this, tr("Error"),
+          tr("Image \"<i>") + fileName + tr("</i>\" cannot be loaded!"));
+}
+
+void MainWindow::toggleLatencyOverlay()
+{
+  area->setLatencyOverlay(latencyAction->isChecked());
+}
+
+void MainWindow::fitToWindow()
+{
+  area->resetView();
 }
 
 void MainWindow::exit()
@@ -304,8 +411,13 @@ void MainWindow::selected(BARG arg)
   QString msg = QString::asprintf("Tool %d. selected.", type);
   statusBar()->showMessage(msg);
 
-  if ((type > ToolType::NONE && type < ToolType::Color) || type == ToolType::Select)
+  if ((type > ToolType::NONE && type < ToolType::Color) || type == ToolType::Select || type == ToolType::Eyedropper)
     area->setTool(type);  
   else if (type == ToolType::Color)
-    area->setColor(QColorDialog::getColor());
+  {
+    // picked color is used for new shapes and given to selected one
+    QColor color = QColorDialog::getColor();
+    area->setColor(color);
+    area->recolorShape(area->getSelected(), color);
+  }
 }
@@ -0,0 +1,138 @@
+#include "maskrenderer.hpp"
+#include "projectreader.hpp"
+#include "rasterizer.hpp"
+#include "renderarea.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <atomic>
+
+std::vector<quint16> MaskRenderer::renderInstances(const std::vector<Shape*> &shapes, QSize size)
+{
+  std::vector<quint16> mask((size_t)size.width() * size.height(), 0);
+  QRect clip(QPoint(0, 0), size);
+
+  std::vector<Span> spans;
+  for (size_t i = 0; i < shapes.size(); i++)
+  {
+    spans.clear();
+    Rasterizer::shapeSpans(shapes[i], clip, spans);
+    Rasterizer::fill(mask.data(), size.width(), QPoint(0, 0), spans, (quint16)std::min<size_t>(i + 1, INSTANCE_MASK_MAX));
+  }
+
+  return mask;
+}
+
+QImage MaskRenderer::renderLabels(const std::vector<Shape*> &shapes, QSize size)
+{
+  QImage mask(size, QImage::Format_Grayscale8);
+  if (mask.isNull()) return mask;
+  mask.fill(0);
+  QRect clip(QPoint(0, 0), size);
+
+  // spans are filled straight into image scanlines
+  std::vector<Span> spans;
+  for (const auto shape : shapes)
+  {
+    spans.clear();
+    Rasterizer::shapeSpans(shape, clip, spans);
+    Rasterizer::fill(mask.bits(), mask.bytesPerLine(), QPoint(0, 0), spans, (uint8_t)((int)shape->type + 1));
+  }
+
+  return mask;
+}
+
+static bool writeInstanceMask(const QString &fileName, const std::vector<quint16> &mask, QSize size)
+{
+  // binary 16-bit PGM, samples are big-endian
+  QFile file(fileName);
+  if (!file.open(QFile::WriteOnly)) return false;
+
+  QByteArray header = QString("P5\n%1 %2\n65535\n").arg(size.width()).arg(size.height()).toLatin1();
+  QByteArray data((int)(mask.size() * 2), Qt::Uninitialized);
+  uchar *p = (uchar*)data.data();
+  for (size_t i = 0; i < mask.size(); i++)
+  {
+    p[2*i] = (uchar)(mask[i] >> 8);
+    p[2*i+1] = (uchar)mask[i];
+  }
+  return file.write(header) == header.size() && file.write(data) == data.size();
+}
+
+bool MaskRenderer::renderProject(const QString &projectFile, const QString &outputDir, MaskMode mode, QString &error)
+{
+  ProjectReader reader(projectFile);
+  ShapeStore store;
+  std::vector<Shape*> shapes;
+  if (!reader.open() || !reader.readShapes(store, shapes))
+  {
+    error = reader.errorString();
+    return false;
+  }
+
+  // image paths may be relative to project file
+  QString imageName = reader.imageName();
+  if (!QFileInfo::exists(imageName))
+    imageName = QFileInfo(projectFile).dir().filePath(imageName);
+
+  // only header is read to get mask size
+  QSize size = QImageReader(imageName).size();
+  bool ok = false;
+  if (mode == MaskMode::Instance && shapes.size() > INSTANCE_MASK_MAX)
+  {
+    error = QString("%1 shapes do not fit 16-bit instance mask (at most %2)!").arg((qulonglong)shapes.size()).arg(INSTANCE_MASK_MAX);
+  } else if (!size.isValid())
+  {
+    error = QString("Cannot read size of image %1!").arg(reader.imageName());
+  } else
+  {
+    QString baseName = QDir(outputDir).filePath(QFileInfo(projectFile).completeBaseName());
+    if (mode == MaskMode::Label)
+    {
+      QImage mask = renderLabels(shapes, size);
+      ok = !mask.isNull() && mask.save(baseName + ".png", "PNG");
+    } else
+    {
+      ok = writeInstanceMask(baseName + ".pgm", renderInstances(shapes, size), size);
+    }
+
+    if (!ok)
+      error = QString("Cannot write mask to %1!").arg(outputDir);
+  }
+
+  return ok;
+}
+
+int MaskRenderer::renderAll(const QStringList &projectFiles, const QString &outputDir, MaskMode mode, int jobs)
+{
+  QThreadPool pool;
+  pool.setMaxThreadCount(jobs);
+
+  // at most two queued projects per thread
+  QSemaphore queueSlots(jobs * 2);
+  std::atomic<int> failed{0};
+
+  for (const auto &projectFile : projectFiles)
+  {
+    queueSlots.acquire();
+    QtConcurrent::run(&pool, [&, projectFile]
+    {
+      QString error;
+      if (!MaskRenderer::renderProject(projectFile, outputDir, mode, error))
+      {
+        qDebug("%s: %s", projectFile.toStdString().c_str(), error.toStdString().c_str());
+        failed++;
+      }
+      queueSlots.release();
+    });
+  }
+
+  pool.waitForDone();
+  return failed.load();
+}
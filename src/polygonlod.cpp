@@ -0,0 +1,80 @@
+#include "polygonlod.hpp"
+
+#include <cmath>
+
+int PolygonLod::levelFor(double scale)
+{
+  if (scale <= 0.0) return -1;
+
+  // coarsest level whose tolerance stays below LOD_TOLERANCE widget pixels
+  int level = (int)std::floor(std::log2(LOD_TOLERANCE / scale));
+  return level < 0 ? -1 : std::min(level, LOD_MAX_LEVEL);
+}
+
+const QPoint *PolygonLod::points(const Shape *shape, double scale, int &count)
+{
+  count = shape->vertices.size();
+  const QPoint *original = shape->vertices.constData();
+  const int level = levelFor(scale);
+  if (count < LOD_MIN_VERTICES || level < 0) return original;
+
+  Entry &entry = entries[shape->id];
+  if (entry.revision != shape->revision || entry.levels.empty())
+  {
+    entry.revision = shape->revision;
+    entry.levels.assign(LOD_MAX_LEVEL + 1, std::vector<QPoint>());
+  }
+
+  std::vector<QPoint> &result = entry.levels[level];
+  if (result.empty())
+  {
+    // finer level is smaller input, errors of levels add up to less than 2^(level+1)
+    int finer = level - 1;
+    while (finer >= 0 && entry.levels[finer].empty())
+      finer--;
+    if (finer >= 0)
+      decimate(entry.levels[finer].data(), (int)entry.levels[finer].size(), 1 << level, result);
+    else
+      decimate(original, count, 1 << level, result);
+  }
+
+  count = (int)result.size();
+  return result.data();
+}
+
+const QPoint *PolygonLod::cached(const Shape *shape, double scale, int &count) const
+{
+  count = shape->vertices.size();
+  const QPoint *original = shape->vertices.constData();
+  const int level = levelFor(scale);
+  if (count < LOD_MIN_VERTICES || level < 0) return original;
+
+  auto it = entries.constFind(shape->id);
+  if (it == entries.constEnd() || it->revision != shape->revision || it->levels.empty()) return original;
+
+  const std::vector<QPoint> &result = it->levels[level];
+  if (result.empty()) return original;
+  count = (int)result.size();
+  return result.data();
+}
+
+void PolygonLod::decimate(const QPoint *points, int count, int tolerance, std::vector<QPoint> &result)
+{
+  result.clear();
+  if (count <= 0) return;
+
+  const qint64 limit = (qint64)tolerance * tolerance;
+  result.push_back(points[0]);
+  QPoint last = points[0];
+  for (int i = 1; i < count - 1; i++)
+  {
+    const qint64 dx = points[i].x() - last.x(), dy = points[i].y() - last.y();
+    if (dx*dx + dy*dy < limit) continue;
+    result.push_back(points[i]);
+    last = points[i];
+  }
+
+  // closing vertex is kept so outline ends where it did
+  if (count > 1) result.push_back(points[count - 1]);
+  result.shrink_to_fit();
+}
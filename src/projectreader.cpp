@@ -0,0 +1,138 @@
+#include "projectreader.hpp"
+#include "renderarea.hpp"
+
+ProjectReader::ProjectReader(const QString &fileName) : file(fileName)
+{
+}
+
+ProjectReader::~ProjectReader()
+{
+  // unmaps data
+  file.close();
+}
+
+bool ProjectReader::open()
+{
+  if (!file.open(QFile::ReadOnly))
+  {
+    error = QString("Cannot read file %1!").arg(file.fileName());
+    return false;
+  }
+
+  size = (size_t)file.size();
+  data = size > 0 ? file.map(0, file.size()) : nullptr;
+  if (!data)
+  {
+    buffer = file.readAll();
+    data = (const uchar*)buffer.constData();
+    size = (size_t)buffer.size();
+  }
+
+  qDebug("Data size: %zu.\n", size);
+
+  if (size < sizeof(char)*3 + sizeof(int8_t) || data[0] != 'G' || data[1] != 'K' || data[2] != '2')
+  {
+    error = "Magic not found!";
+    return false;
+  }
+
+  if (data[3] == 0)
+    return openV2();
+
+  // MAGICSTR + SIZEOF(FILENAME) + FILENAME = DATA_OFFSET
+  version = 1;
+  size_t fileNameSize = data[3];
+  shapesOffset = sizeof(int8_t) + sizeof(char)*3 + fileNameSize*sizeof(char);
+  if (shapesOffset > size || data[shapesOffset-1] != 0)
+  {
+    error = "Image file name is truncated!";
+    return false;
+  }
+
+  image = QString::fromUtf8((const char*)data + sizeof(char)*3 + sizeof(int8_t));
+  if ((size_t)image.toUtf8().size() + 1 != fileNameSize)
+  {
+    error = "Wrong file name sizes!";
+    return false;
+  }
+
+  return true;
+}
+
+bool ProjectReader::openV2()
+{
+  // MAGICSTR + 0 + VERSION + SIZEOF(FILENAME) + FILENAME + SHAPES = DATA_OFFSET
+  size_t p = sizeof(char)*3 + sizeof(uint8_t);
+  if (size < p + sizeof(uint8_t) + sizeof(uint32_t))
+  {
+    error = "Header is truncated!";
+    return false;
+  }
+
+  version = data[p++];
+  if (version != 2)
+  {
+    error = QString("Unsupported project version %1!").arg(version);
+    return false;
+  }
+
+  size_t fileNameSize = readU32LE(data+p);
+  p += sizeof(uint32_t);
+  if (fileNameSize > size - p || size - p - fileNameSize < sizeof(uint32_t))
+  {
+    error = "Image file name is truncated!";
+    return false;
+  }
+
+  image = QString::fromUtf8((const char*)data + p, (int)fileNameSize);
+  p += fileNameSize;
+  shapesCount = readU32LE(data+p);
+  p += sizeof(uint32_t);
+
+  shapesOffset = p;
+  return true;
+}
+
+bool ProjectReader::readShapes(ShapeStore &store, std::vector<Shape*> &shapes)
+{
+  std::vector<Shape*> result;
+  // every v2 record takes at least 9 bytes so stored count can not force huge reservation
+  if (version >= 2)
+    result.reserve(std::min<size_t>(shapesCount, (size - shapesOffset) / 9));
+
+  auto fail = [this, &store, &result](size_t offset)
+  {
+    error = QString("Corrupt shape record at offset %1!").arg(offset);
+    for (auto s : result)
+      store.destroy(s);
+    return false;
+  };
+
+  size_t p = shapesOffset;
+  while (p < size)
+  {
+    // records are parsed straight into store slots, vertices into its arena
+    Shape *shape = store.create();
+    size_t dp = 0;
+    if (version == 1)
+      dp = RenderArea::deserializeShape((const int8_t*)(data+p), size-p, *shape);
+    else
+      dp = RenderArea::deserializeShapeV2(data+p, size-p, *shape);
+    if (dp == 0)
+    {
+      store.destroy(shape);
+      return fail(p);
+    }
+
+    p += dp;
+
+    shape->restoreAnchor();
+    result.push_back(shape);
+  }
+
+  if (version >= 2 && result.size() != shapesCount)
+    return fail(p);
+
+  shapes.insert(shapes.end(), result.begin(), result.end());
+  return true;
+}
@@ -0,0 +1,105 @@
+#include "projectwriter.hpp"
+#include "renderarea.hpp"
+
+#include <QSaveFile>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static inline size_t headerSize(const std::string &imageName, int version)
+{
+  // MAGICSTR + SIZEOF(FILENAME) + FILENAME
+  if (version == 1)
+    return sizeof(char)*3 + sizeof(int8_t) + imageName.size() + 1;
+
+  // MAGICSTR + 0 + VERSION + SIZEOF(FILENAME) + FILENAME + SHAPES
+  return sizeof(char)*3 + sizeof(uint8_t)*2 + sizeof(uint32_t) + imageName.size() + sizeof(uint32_t);
+}
+
+size_t ProjectWriter::encodedSize(const std::string &imageName, const std::vector<Shape*> &shapes, int version)
+{
+  size_t size = headerSize(imageName, version);
+  for (const auto s : shapes)
+    size += version == 1 ? RenderArea::serializedShapeSize(s) : RenderArea::serializedShapeSizeV2(s);
+  return size;
+}
+
+QByteArray ProjectWriter::encode(const std::string &imageName, const std::vector<Shape*> &shapes, int version)
+{
+  QByteArray b(encodedSize(imageName, shapes, version), Qt::Uninitialized);
+  uint8_t *data = (uint8_t*)b.data();
+
+  size_t p = 0;
+  memcpy(data, "GK2", 3); // add magic
+  p += 3;
+
+  if (version == 1)
+  {
+    data[p++] = (uint8_t)(imageName.size()+1); // names longer than 254 bytes need v2
+    memcpy(data+p, imageName.c_str(), imageName.size()+1);
+    p += imageName.size()+1;
+
+    for (const auto s : shapes)
+      p += RenderArea::serializeShape(s, (int8_t*)data+p);
+    return b;
+  }
+
+  data[p++] = 0; // v1 file name size is never 0
+  data[p++] = (uint8_t)version;
+  writeU32LE(data+p, (uint32_t)imageName.size());
+  p += sizeof(uint32_t);
+  memcpy(data+p, imageName.data(), imageName.size());
+  p += imageName.size();
+  writeU32LE(data+p, (uint32_t)shapes.size());
+  p += sizeof(uint32_t);
+
+  for (const auto s : shapes)
+    p += RenderArea::serializeShapeV2(s, data+p);
+
+  return b;
+}
+
+std::shared_ptr<const ProjectSnapshot> ProjectWriter::snapshot(const std::string &imageName,
+                                                              const std::vector<Shape*> &shapes)
+{
+  std::shared_ptr<ProjectSnapshot> snap(new ProjectSnapshot);
+  snap->imageName = imageName;
+  snap->shapes.reserve(shapes.size());
+  for (const auto s : shapes)
+  {
+    Shape *copy = snap->store.create(s->id);
+    copy->type = s->type;
+    copy->position = s->position;
+    copy->size = s->size;
+    copy->color = s->color;
+    copy->vertices = s->vertices;
+    snap->shapes.push_back(copy);
+  }
+  return snap;
+}
+
+bool ProjectWriter::sync(QFileDevice &file)
+{
+  if (!file.flush()) return false;
+#ifdef Q_OS_WIN
+  return _commit(file.handle()) == 0;
+#else
+  return ::fsync(file.handle()) == 0;
+#endif
+}
+
+bool ProjectWriter::save(const QString &fileName, const QByteArray &data)
+{
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) return false;
+
+  if (file.write(data) != data.size() || !sync(file))
+  {
+    file.cancelWriting();
+    return false;
+  }
+  return file.commit();
+}
@@ -0,0 +1,405 @@
+#include "rasterizer.hpp"
+#include "shape.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RASTERIZER_X86
+#endif
+
+#ifdef __SIZEOF_INT128__
+typedef __int128 wide_t;
+#else
+typedef long double wide_t;
+#endif
+
+static inline int64_t floorDiv(int64_t a, int64_t b)
+{
+  int64_t q = a / b;
+  return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+static inline int64_t ceilDiv(int64_t a, int64_t b)
+{
+  return -floorDiv(-a, b);
+}
+
+/*
+ * Edge crossing at row y (pixel centers at y+0.5) is x_i = x0 + (y+0.5-y0)*dx/dy.
+ * First pixel whose center is right of it is x = ceil(x_i - 0.5) = ceil(A/D) where
+ *   A = (2y+1-2y0)*dx + (2x0-1)*dy,  D = 2dy.
+ * A grows by 2dx every row so x is stepped with quotient and remainder.
+ */
+struct Edge
+{
+  int yLast;     // last row crossed by edge
+  int64_t x;     // ceil(A/D)
+  int64_t rem;   // x*D - A, 0 <= rem < D
+  int64_t D;
+  int64_t stepQ; // floor(2dx/D)
+  int64_t stepR; // 2dx - stepQ*D
+
+  inline void step()
+  {
+    x += stepQ;
+    rem -= stepR;
+    if (rem < 0)
+    {
+      x++;
+      rem += D;
+    }
+  }
+};
+
+void Rasterizer::polygonSpans(const QPoint *points, int count, const QRect &clip, std::vector<Span> &spans)
+{
+  if (count < 3 || clip.isEmpty()) return;
+
+  // edges sorted by first row
+  std::vector<std::pair<int, Edge>> edges;
+  edges.reserve(count);
+  int yMin = clip.bottom() + 1, yMax = clip.top() - 1;
+  for (int i = 0; i < count; i++)
+  {
+    QPoint a = points[i], b = points[(i + 1) % count];
+    if (a.y() == b.y()) continue; // horizontal edges are never crossed
+    if (a.y() > b.y()) std::swap(a, b);
+
+    // rows whose centers are in [a.y, b.y)
+    int yFirst = std::max(a.y(), clip.top());
+    int yLast = std::min(b.y() - 1, clip.bottom());
+    if (yFirst > yLast) continue;
+
+    int64_t dx = (int64_t)b.x() - a.x(), dy = (int64_t)b.y() - a.y();
+    Edge e;
+    e.yLast = yLast;
+    e.D = 2*dy;
+    int64_t A = (2*(int64_t)yFirst + 1 - 2*(int64_t)a.y())*dx + (2*(int64_t)a.x() - 1)*dy;
+    e.x = ceilDiv(A, e.D);
+    e.rem = e.x*e.D - A;
+    e.stepQ = floorDiv(2*dx, e.D);
+    e.stepR = 2*dx - e.stepQ*e.D;
+
+    edges.push_back({yFirst, e});
+    yMin = std::min(yMin, yFirst);
+    yMax = std::max(yMax, yLast);
+  }
+  if (edges.empty()) return;
+
+  std::sort(edges.begin(), edges.end(), [](const std::pair<int, Edge> &a, const std::pair<int, Edge> &b)
+  {
+    return a.first < b.first;
+  });
+
+  std::vector<Edge> active;
+  std::vector<int64_t> xs;
+  size_t next = 0;
+  for (int y = yMin; y <= yMax; y++)
+  {
+    while (next < edges.size() && edges[next].first == y)
+      active.push_back(edges[next++].second);
+
+    xs.clear();
+    for (const auto &e : active)
+      xs.push_back(e.x);
+    // crossings stay almost sorted between rows
+    for (size_t i = 1; i < xs.size(); i++)
+    {
+      int64_t v = xs[i];
+      size_t j = i;
+      for (; j > 0 && xs[j-1] > v; j--)
+        xs[j] = xs[j-1];
+      xs[j] = v;
+    }
+
+    for (size_t i = 0; i + 1 < xs.size(); i += 2)
+    {
+      int64_t x0 = std::max<int64_t>(xs[i], clip.left());
+      int64_t x1 = std::min<int64_t>(xs[i+1], (int64_t)clip.right() + 1);
+      if (x0 < x1) spans.push_back(Span{y, (int)x0, (int)x1});
+    }
+
+    // drop finished edges, advance the rest
+    size_t n = 0;
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      if (active[i].yLast <= y) continue;
+      active[i].step();
+      active[n++] = active[i];
+    }
+    active.resize(n);
+  }
+}
+
+void Rasterizer::ellipseSpans(const QRect &r, const QRect &clip, std::vector<Span> &spans)
+{
+  QRect rect = r.normalized();
+  int64_t w = rect.width(), h = rect.height();
+  if (w <= 0 || h <= 0) return;
+
+  /*
+   * With X = 2px+1-(2x+w) and Y = 2py+1-(2y+h) pixel center is inside when
+   *   X^2 h^2 + Y^2 w^2 <= w^2 h^2
+   */
+  int yFirst = std::max(rect.top(), clip.top());
+  int yLast = std::min(rect.bottom(), clip.bottom());
+  int64_t cx = 1 - 2*(int64_t)rect.left() - w;
+  for (int py = yFirst; py <= yLast; py++)
+  {
+    int64_t Y = 2*(int64_t)py + 1 - (2*(int64_t)rect.top() + h);
+    if (Y*Y > h*h) continue;
+
+    // largest |X| inside, estimated in floating point and corrected exactly
+    wide_t T = (wide_t)w*w*(wide_t)(h*h - Y*Y);
+    int64_t X = (int64_t)std::floor(std::sqrt((double)T) / (double)h);
+    while (X > 0 && (wide_t)X*X*(wide_t)(h*h) > T) X--;
+    while ((wide_t)(X+1)*(X+1)*(wide_t)(h*h) <= T) X++;
+
+    // X = 2px + cx
+    int64_t x0 = std::max<int64_t>(ceilDiv(-X - cx, 2), clip.left());
+    int64_t x1 = std::min<int64_t>(floorDiv(X - cx, 2) + 1, (int64_t)clip.right() + 1);
+    if (x0 < x1) spans.push_back(Span{py, (int)x0, (int)x1});
+  }
+}
+
+void Rasterizer::rectSpans(const QRect &r, const QRect &clip, std::vector<Span> &spans)
+{
+  QRect rect = r.normalized() & clip;
+  if (rect.isEmpty()) return;
+
+  for (int y = rect.top(); y <= rect.bottom(); y++)
+    spans.push_back(Span{y, rect.left(), rect.right() + 1});
+}
+
+void Rasterizer::shapeSpans(const Shape *shape, const QRect &clip, std::vector<Span> &spans)
+{
+  QPoint pos(shape->position.x, shape->position.y);
+  QPoint size(shape->size.x, shape->size.y);
+
+  switch (shape->type)
+  {
+    case ShapeType::Circle:
+      ellipseSpans(QRect(pos.x()-size.x()/2, pos.y()-size.y()/2, size.x(), size.y()), clip, spans);
+      break;
+    case ShapeType::Rectangle:
+      rectSpans(QRect(pos.x(), pos.y(), size.x()/2, size.y()/2), clip, spans);
+      break;
+    case ShapeType::Polygon:
+      polygonSpans(shape->vertices.constData(), shape->vertices.size(), clip, spans);
+      break;
+    default:
+      break;
+  }
+}
+
+static void fillSpan8Scalar(uint8_t *row, int count, uint8_t value)
+{
+  memset(row, value, count);
+}
+
+static void fillSpan16Scalar(uint16_t *row, int count, uint16_t value)
+{
+  for (int i = 0; i < count; i++)
+    row[i] = value;
+}
+
+#ifdef RASTERIZER_X86
+__attribute__((target("sse2")))
+static void fillSpan8Sse2(uint8_t *row, int count, uint8_t value)
+{
+  __m128i v = _mm_set1_epi8((char)value);
+  int i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm_storeu_si128((__m128i*)(row + i), v);
+  for (; i < count; i++)
+    row[i] = value;
+}
+
+__attribute__((target("sse2")))
+static void fillSpan16Sse2(uint16_t *row, int count, uint16_t value)
+{
+  __m128i v = _mm_set1_epi16((short)value);
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm_storeu_si128((__m128i*)(row + i), v);
+  for (; i < count; i++)
+    row[i] = value;
+}
+
+__attribute__((target("avx2")))
+static void fillSpan8Avx2(uint8_t *row, int count, uint8_t value)
+{
+  __m256i v = _mm256_set1_epi8((char)value);
+  int i = 0;
+  for (; i + 32 <= count; i += 32)
+    _mm256_storeu_si256((__m256i*)(row + i), v);
+  for (; i < count; i++)
+    row[i] = value;
+}
+
+__attribute__((target("avx2")))
+static void fillSpan16Avx2(uint16_t *row, int count, uint16_t value)
+{
+  __m256i v = _mm256_set1_epi16((short)value);
+  int i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm256_storeu_si256((__m256i*)(row + i), v);
+  for (; i < count; i++)
+    row[i] = value;
+}
+#endif
+
+// implementation is selected once from CPU features
+typedef void (*FillSpan8)(uint8_t*, int, uint8_t);
+typedef void (*FillSpan16)(uint16_t*, int, uint16_t);
+
+static FillSpan8 selectFillSpan8()
+{
+#ifdef RASTERIZER_X86
+  if (__builtin_cpu_supports("avx2")) return fillSpan8Avx2;
+  if (__builtin_cpu_supports("sse2")) return fillSpan8Sse2;
+#endif
+  return fillSpan8Scalar;
+}
+
+static FillSpan16 selectFillSpan16()
+{
+#ifdef RASTERIZER_X86
+  if (__builtin_cpu_supports("avx2")) return fillSpan16Avx2;
+  if (__builtin_cpu_supports("sse2")) return fillSpan16Sse2;
+#endif
+  return fillSpan16Scalar;
+}
+
+void Rasterizer::fillSpan(uint8_t *row, int count, uint8_t value)
+{
+  static const FillSpan8 impl = selectFillSpan8();
+  impl(row, count, value);
+}
+
+void Rasterizer::fillSpan(uint16_t *row, int count, uint16_t value)
+{
+  static const FillSpan16 impl = selectFillSpan16();
+  impl(row, count, value);
+}
+
+void Rasterizer::fill(uint8_t *buffer, int stride, QPoint origin, const std::vector<Span> &spans, uint8_t value)
+{
+  for (const auto &s : spans)
+    fillSpan(buffer + (size_t)(s.y - origin.y())*stride + (s.x0 - origin.x()), s.x1 - s.x0, value);
+}
+
+void Rasterizer::fill(uint16_t *buffer, int stride, QPoint origin, const std::vector<Span> &spans, uint16_t value)
+{
+  for (const auto &s : spans)
+    fillSpan(buffer + (size_t)(s.y - origin.y())*stride + (s.x0 - origin.x()), s.x1 - s.x0, value);
+}
+
+#define VERIFY_CLIP_SIZE 64
+#define VERIFY_SHAPES 2000
+
+// pixel center lies right of edge crossing at its row (x_i <= px+0.5), scaled by 2dy
+static bool crossedBefore(QPoint a, QPoint b, int px, int py)
+{
+  if (a.y() > b.y()) std::swap(a, b);
+  const int64_t dx = (int64_t)b.x() - a.x(), dy = (int64_t)b.y() - a.y();
+  return 2*(int64_t)a.x()*dy + (2*(int64_t)py + 1 - 2*(int64_t)a.y())*dx <= (2*(int64_t)px + 1)*dy;
+}
+
+static bool polygonCovers(const std::vector<QPoint> &points, int px, int py)
+{
+  bool inside = false;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    QPoint a = points[i], b = points[(i + 1) % points.size()];
+    if (a.y() == b.y() || py < std::min(a.y(), b.y()) || py >= std::max(a.y(), b.y())) continue;
+    if (crossedBefore(a, b, px, py)) inside = !inside;
+  }
+  return inside;
+}
+
+static bool ellipseCovers(const QRect &r, int px, int py)
+{
+  QRect rect = r.normalized();
+  const int64_t w = rect.width(), h = rect.height();
+  if (w <= 0 || h <= 0) return false;
+  const int64_t X = 2*(int64_t)px + 1 - (2*(int64_t)rect.left() + w);
+  const int64_t Y = 2*(int64_t)py + 1 - (2*(int64_t)rect.top() + h);
+  return (wide_t)X*X*(wide_t)(h*h) + (wide_t)Y*Y*(wide_t)(w*w) <= (wide_t)(w*w)*(wide_t)(h*h);
+}
+
+template <typename T, typename Scalar>
+static bool verifyFill(Scalar scalar, const char *name)
+{
+  // every length and alignment up to few vector widths, guards catch overruns
+  std::vector<T> expected(320), actual(320);
+  for (int offset = 0; offset < 32; offset++)
+  {
+    for (int count = 0; count <= 256; count++)
+    {
+      std::fill(expected.begin(), expected.end(), (T)0x5a);
+      std::fill(actual.begin(), actual.end(), (T)0x5a);
+      scalar(expected.data() + offset, count, (T)0xa5);
+      Rasterizer::fillSpan(actual.data() + offset, count, (T)0xa5);
+      if (expected != actual)
+      {
+        qDebug("Rasterizer: %s fill differs from scalar one (offset %d, count %d).", name, offset, count);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Rasterizer::verify(quint32 seed)
+{
+  if (!verifyFill<uint8_t>(fillSpan8Scalar, "8-bit") || !verifyFill<uint16_t>(fillSpan16Scalar, "16-bit"))
+    return false;
+
+  // shapes reach over clip edges, so clipping is covered too
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> coord(-VERIFY_CLIP_SIZE/4, VERIFY_CLIP_SIZE*5/4), vertexCount(3, 12), kind(0, 1);
+  const QRect clip(0, 0, VERIFY_CLIP_SIZE, VERIFY_CLIP_SIZE);
+  std::vector<uint8_t> mask(VERIFY_CLIP_SIZE * VERIFY_CLIP_SIZE);
+  std::vector<Span> spans;
+  std::vector<QPoint> points;
+
+  for (int i = 0; i < VERIFY_SHAPES; i++)
+  {
+    const bool polygon = kind(rng) == 0;
+    QRect rect;
+    points.clear();
+    spans.clear();
+    if (polygon)
+    {
+      const int n = vertexCount(rng);
+      for (int v = 0; v < n; v++)
+        points.push_back(QPoint(coord(rng), coord(rng)));
+      polygonSpans(points.data(), (int)points.size(), clip, spans);
+    } else
+    {
+      rect = QRect(QPoint(coord(rng), coord(rng)), QPoint(coord(rng), coord(rng)));
+      ellipseSpans(rect, clip, spans);
+    }
+
+    std::fill(mask.begin(), mask.end(), 0);
+    fill(mask.data(), VERIFY_CLIP_SIZE, QPoint(0, 0), spans, 1);
+    for (int py = 0; py < VERIFY_CLIP_SIZE; py++)
+    {
+      for (int px = 0; px < VERIFY_CLIP_SIZE; px++)
+      {
+        const bool covered = polygon ? polygonCovers(points, px, py) : ellipseCovers(rect, px, py);
+        if (covered != (mask[py*VERIFY_CLIP_SIZE + px] != 0))
+        {
+          qDebug("Rasterizer: %s %d differs from reference at %d,%d.", polygon ? "polygon" : "ellipse", i, px, py);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
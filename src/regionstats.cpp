@@ -0,0 +1,122 @@
+#include "regionstats.hpp"
+#include "rasterizer.hpp"
+#include "shape.hpp"
+
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <vector>
+
+struct StatsChunk
+{
+  size_t begin;
+  size_t end;
+  quint64 count;
+  std::array<quint32, 256> histogram[3];
+};
+
+static void reduceChunk(const QImage &image, QSize imageSize, const std::vector<Span> &spans, StatsChunk &chunk)
+{
+  chunk.count = 0;
+  for (auto &h : chunk.histogram)
+    h.fill(0);
+
+  quint32 *hr = chunk.histogram[0].data();
+  quint32 *hg = chunk.histogram[1].data();
+  quint32 *hb = chunk.histogram[2].data();
+  const bool scaled = image.size() != imageSize;
+
+  for (size_t i = chunk.begin; i < chunk.end; i++)
+  {
+    const Span &s = spans[i];
+    int sy = scaled ? (int)((qint64)s.y * image.height() / imageSize.height()) : s.y;
+    const QRgb *line = (const QRgb*)image.constScanLine(sy);
+
+    if (!scaled)
+    {
+      for (int x = s.x0; x < s.x1; x++)
+      {
+        QRgb c = line[x];
+        hr[qRed(c)]++;
+        hg[qGreen(c)]++;
+        hb[qBlue(c)]++;
+      }
+    } else
+    {
+      // nearest preview pixel, every full resolution pixel is counted
+      for (int x = s.x0; x < s.x1; x++)
+      {
+        QRgb c = line[(qint64)x * image.width() / imageSize.width()];
+        hr[qRed(c)]++;
+        hg[qGreen(c)]++;
+        hb[qBlue(c)]++;
+      }
+    }
+    chunk.count += s.x1 - s.x0;
+  }
+}
+
+RegionStats RegionStats::compute(const QImage &image, QSize imageSize, const Shape &shape)
+{
+  RegionStats stats;
+  if (image.isNull() || imageSize.isEmpty()) return stats;
+  if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32)
+    return compute(image.convertToFormat(QImage::Format_RGB32), imageSize, shape);
+
+  std::vector<Span> spans;
+  Rasterizer::shapeSpans(&shape, QRect(QPoint(0, 0), imageSize), spans);
+  if (spans.empty()) return stats;
+
+  // spans are split into chunks of similar pixel count
+  std::vector<StatsChunk> chunks;
+  size_t begin = 0;
+  quint64 pixels = 0;
+  int minX = spans.front().x0, maxX = spans.front().x1;
+  for (size_t i = 0; i < spans.size(); i++)
+  {
+    minX = std::min(minX, spans[i].x0);
+    maxX = std::max(maxX, spans[i].x1);
+    pixels += spans[i].x1 - spans[i].x0;
+    if (pixels >= STATS_CHUNK_PIXELS || i + 1 == spans.size())
+    {
+      StatsChunk chunk;
+      chunk.begin = begin;
+      chunk.end = i + 1;
+      chunks.push_back(chunk);
+      begin = i + 1;
+      pixels = 0;
+    }
+  }
+  stats.bounds = QRect(QPoint(minX, spans.front().y), QPoint(maxX - 1, spans.back().y));
+
+  auto reduce = [&](StatsChunk &chunk) { reduceChunk(image, imageSize, spans, chunk); };
+  if (chunks.size() == 1)
+    reduce(chunks.front());
+  else
+    QtConcurrent::blockingMap(chunks, reduce);
+
+  for (const auto &chunk : chunks)
+  {
+    stats.count += chunk.count;
+    for (int c = 0; c < 3; c++)
+      for (int v = 0; v < 256; v++)
+        stats.histogram[c][v] += chunk.histogram[c][v];
+  }
+  if (stats.count == 0) return stats;
+
+  for (int c = 0; c < 3; c++)
+  {
+    quint64 sum = 0, below = 0;
+    stats.median[c] = -1;
+    for (int v = 0; v < 256; v++)
+    {
+      sum += (quint64)stats.histogram[c][v] * v;
+      below += stats.histogram[c][v];
+      if (stats.median[c] < 0 && below * 2 >= stats.count)
+        stats.median[c] = v;
+    }
+    stats.mean[c] = (double)sum / stats.count;
+  }
+
+  return stats;
+}
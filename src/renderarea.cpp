@@ -2,37 +2,447 @@
 #include "mainwindow.hpp"
 
 #include <QtWidgets>
+#include <QtConcurrent>
+#include <cmath>
 
 RenderArea::RenderArea(QWidget *parent) : QWidget(parent)
 {
   myParent = parent;
 
   setMouseTracking(true);
+
+  // smooth rescale and antialiasing are expensive so they wait until input stops
+  qualityTimer = new QTimer(this);
+  qualityTimer->setSingleShot(true);
+  qualityTimer->setInterval(QUALITY_DELAY);
+  connect(qualityTimer, &QTimer::timeout, this, &RenderArea::endInteraction);
+
+  // applies coalesced mouse moves paced to display refresh
+  frameTimer = new QTimer(this);
+  frameTimer->setSingleShot(true);
+  frameTimer->setTimerType(Qt::PreciseTimer);
+  connect(frameTimer, &QTimer::timeout, this, &RenderArea::applyMove);
+  frameClock.start();
+
+  // preview is shown first, full resolution image replaces it when decoded
+  loader = new ImageLoader(this);
+  connect(loader, &ImageLoader::progress, this, &RenderArea::loadProgress);
+  connect(loader, &ImageLoader::failed, this, &RenderArea::loadFailed);
+  connect(loader, &ImageLoader::previewLoaded, this, [this](QImage preview, QSize fullSize)
+  {
+    setImage(preview, ImagePyramid::buildLevels(preview), fullSize);
+  });
+  connect(loader, &ImageLoader::imageLoaded, this, [this](QImage full, std::vector<QImage> levels)
+  {
+    setImage(full, std::move(levels), full.size());
+  });
 }
 
 RenderArea::~RenderArea()
 {
-  delete this->currentShape;
-  for (auto &obj : this->shapes)
-    delete obj;
+  statsPool.waitForDone();
 
+  // shapes are released with store
   delete this->image;
 }
 
 bool RenderArea::loadImage(const QString &fileName)
 {
-  if (image) delete image;
   this->fileName = fileName.toStdString();
 
-  image = new QImage(fileName);
-  return !image->isNull();
+  // preview is decoded at screen resolution
+  QSize previewSize;
+  if (QScreen *screen = QGuiApplication::primaryScreen())
+    previewSize = screen->size() * screen->devicePixelRatio();
+
+  newImagePending = true;
+  return loader->load(fileName, previewSize);
+}
+
+void RenderArea::setImage(const QImage &img, std::vector<QImage> levels, QSize fullSize)
+{
+  // swap whole image at once, shapes stay in full resolution image space
+  delete image;
+  image = new QImage(img);
+  pyramid.setLevels(std::move(levels), fullSize);
+  invalidateStaticLayer();
+
+  if (newImagePending || fullSize != imageSize)
+  {
+    // new image is always shown whole
+    newImagePending = false;
+    imageSize = fullSize;
+    zoom = 1.0;
+    pan = QPointF(0.0, 0.0);
+    updateViewTransform();
+  }
+
+  rebuildScaledImage(Qt::SmoothTransformation);
+  update();
+
+  // statistics computed from preview are refreshed from full image
+  for (auto shape : stats.keys())
+    requestStats(shape);
+}
+
+void RenderArea::setShapes(ShapeStore &&loaded, const std::vector<Shape*> &newShapes)
+{
+  // results of running tasks belong to old shapes
+  stats.clear();
+  for (auto &task : statsTasks)
+    task = StatsTask::Dropped;
+  index.clear();
+  lod.clear();
+  currentShape = nullptr;
+  selectedShape = nullptr;
+
+  history.clear();
+  emit historyChanged();
+
+  store = std::move(loaded);
+  shapes = newShapes;
+  renumberRows(0);
+  invalidateStaticLayer();
+  for (auto shape : shapes)
+    index.insert(shape, shapeImageBounds(shape));
+  update();
+}
+
+// whole shape in GK2 v2 record layout, kept by create and delete commands
+static QByteArray shapeRecord(const Shape *shape)
+{
+  QByteArray record((int)RenderArea::serializedShapeSizeV2(shape), Qt::Uninitialized);
+  RenderArea::serializeShapeV2(shape, (uint8_t*)record.data());
+  return record;
+}
+
+void RenderArea::insertShape(Shape *shape, int row)
+{
+  row = qBound(0, row, (int)shapes.size());
+  invalidateStaticLayer();
+  emit shapeAboutToBeInserted(row);
+  shapes.insert(shapes.begin() + row, shape);
+  renumberRows(row);
+  index.insert(shape, shapeImageBounds(shape));
+  emit shapeInserted(row);
+  update(shapeBounds(shape));
+}
+
+void RenderArea::removeShape(Shape *shape)
+{
+  int row = rowOf(shape);
+  if (row < 0) return;
+
+  QRect dirty = shapeBounds(shape);
+  if (selectedShape == shape)
+    selectedShape = nullptr;
+
+  invalidateStaticLayer();
+  emit shapeAboutToBeRemoved(row);
+  dropStats(shape);
+  index.remove(shape);
+  lod.remove(shape->id);
+  shapes.erase(shapes.begin() + row);
+  renumberRows(row);
+  store.destroy(shape);
+  emit shapeRemoved(row);
+  update(dirty);
+}
+
+void RenderArea::deleteShape(Shape *shape)
+{
+  // only listed shapes can be deleted and undone
+  const int row = rowOf(shape);
+  if (row < 0) return;
+
+  Command remove(CommandType::Delete, shape->id);
+  remove.row = row;
+  remove.record = shapeRecord(shape);
+
+  // shape being drawn is dropped as well
+  QRect dirty = shapeBounds(selectedShape) | shapeBounds(currentShape);
+  store.destroy(currentShape);
+  currentShape = nullptr;
+  selectedShape = nullptr;
+
+  removeShape(shape);
+  record(std::move(remove));
+  update(dirty);
+}
+
+void RenderArea::recolorShape(Shape *shape, QColor c)
+{
+  if (!shape || !c.isValid()) return;
+
+  Command recolor(CommandType::Recolor, shape->id);
+  recolor.before = shape->color;
+  recolor.after = Color(c);
+  shape->color = recolor.after;
+  invalidateStaticLayer();
+  record(std::move(recolor));
+  emit shapeModified(shape);
+  update(shapeBounds(shape));
+}
+
+void RenderArea::undo()
+{
+  // edit in progress has to end first
+  if (!history.canUndo() || currentShape || selectedOrigin || selectedVertex >= 0) return;
+
+  Command command = history.takeUndo();
+  applyCommand(command, true);
+  history.undone(std::move(command));
+  emit historyChanged();
+}
+
+void RenderArea::redo()
+{
+  if (!history.canRedo() || currentShape || selectedOrigin || selectedVertex >= 0) return;
+
+  Command command = history.takeRedo();
+  applyCommand(command, false);
+  history.redone(std::move(command));
+  emit historyChanged();
+}
+
+void RenderArea::applyCommand(Command &command, bool undo)
+{
+  const int sign = undo ? -1 : 1;
+  Shape *shape = store.find(command.shapeId);
+  invalidateStaticLayer();
+
+  switch (command.type)
+  {
+    case CommandType::Create:
+    case CommandType::Delete:
+      if ((command.type == CommandType::Create) == undo)
+      {
+        // undo create, redo delete: record is taken now, shape has its state from creation
+        if (!shape) return;
+        if (command.record.isEmpty()) command.record = shapeRecord(shape);
+        command.row = rowOf(shape);
+        removeShape(shape);
+      } else
+      {
+        // shape is recreated with its old id so other commands still refer to it
+        shape = store.create(command.shapeId);
+        if (!deserializeShapeV2((const uint8_t*)command.record.constData(), (size_t)command.record.size(), *shape))
+        {
+          store.destroy(shape);
+          return;
+        }
+        shape->restoreAnchor();
+        command.shapeId = shape->id;
+        insertShape(shape, command.row);
+        requestStats(shape);
+      }
+      return;
+    case CommandType::Recolor:
+      if (!shape) return;
+      shape->color = undo ? command.before : command.after;
+      emit shapeModified(shape);
+      update(shapeBounds(shape));
+      return;
+    default:
+      break;
+  }
+
+  if (!shape) return;
+  QRect dirty = shapeBounds(shape);
+
+  if (command.type == CommandType::MoveOrigin)
+  {
+    index.removeVertices(shape);
+    shape->position.x += sign*command.delta.x();
+    shape->position.y += sign*command.delta.y();
+    for (auto &v : shape->vertices)
+      v += sign*command.verticesDelta;
+    index.insertVertices(shape);
+  } else
+  if (command.type == CommandType::MoveVertex)
+  {
+    if (command.vertex < 0 || command.vertex >= shape->vertices.size()) return;
+    QPoint from = shape->vertices.at(command.vertex);
+    QPoint to = from + sign*command.delta;
+    shape->vertices.replace(command.vertex, to);
+    index.moveVertex(shape, command.vertex, from, to);
+    shape->size.x += sign*command.sizeDelta.x();
+    shape->size.y += sign*command.sizeDelta.y();
+  }
+
+  dirty |= refreshBounds(shape);
+  index.updateBounds(shape, shape->imageBounds);
+  if (getStats(shape)) requestStats(shape);
+  emit shapeModified(shape);
+  update(dirty);
+}
+
+void RenderArea::requestStats(Shape *shape)
+{
+  if (!shape || !hasImage()) return;
+
+  // edits made while task runs are picked up by one rerun
+  auto task = statsTasks.find(shape);
+  if (task != statsTasks.end())
+  {
+    *task = *task == StatsTask::Dropped || *task == StatsTask::Replaced ? StatsTask::Replaced : StatsTask::Stale;
+    return;
+  }
+  statsTasks.insert(shape, StatsTask::Running);
+
+  // worker gets its own copies, shape can be edited or deleted meanwhile
+  Shape geometry = *shape;
+  QImage sampled = *image;
+  QSize fullSize = imageSize;
+  QtConcurrent::run(&statsPool, [this, shape, geometry, sampled, fullSize]
+  {
+    RegionStats s = RegionStats::compute(sampled, fullSize, geometry);
+    QMetaObject::invokeMethod(this, [this, shape, s] { statsComputed(shape, s); }, Qt::QueuedConnection);
+  });
+}
+
+void RenderArea::statsComputed(Shape *shape, const RegionStats &s)
+{
+  StatsTask task = statsTasks.take(shape);
+  if (task == StatsTask::Replaced)
+  {
+    requestStats(shape);
+    return;
+  }
+  if (task == StatsTask::Dropped) return;
+
+  stats.insert(shape, s);
+  emit statsChanged(shape);
+
+  if (task == StatsTask::Stale)
+    requestStats(shape);
+}
+
+void RenderArea::rebuildScaledImage(Qt::TransformationMode mode)
+{
+  scaledImage = QPixmap();
+  scaledImageSmooth = mode == Qt::SmoothTransformation;
+  scaledImageRect = QRect();
+  if (!hasImage() || width() <= 0 || height() <= 0) return;
+
+  scaledImageView = viewGeneration;
+  scaledImageKey = image->cacheKey();
+
+  // only visible part of source image is scaled
+  QRect source = visibleImageRect(rect());
+  if (source.isEmpty()) return;
+
+  QRectF target(view.offsetX + source.x()*view.scaleX, view.offsetY + source.y()*view.scaleY,
+                source.width()*view.scaleX, source.height()*view.scaleY);
+  scaledImageRect = target.toAlignedRect() & rect();
+  if (scaledImageRect.isEmpty()) return;
+
+  // draw only visible tiles from level closest to current scale
+  scaledImage = QPixmap(scaledImageRect.size());
+  scaledImage.fill(Qt::transparent);
+
+  QPainter painter(&scaledImage);
+  painter.setRenderHint(QPainter::SmoothPixmapTransform, mode == Qt::SmoothTransformation);
+  painter.translate(-scaledImageRect.topLeft());
+  pyramid.draw(painter, view, scaledImageRect);
+}
+
+void RenderArea::updateViewTransform()
+{
+  if (hasImage())
+  {
+    // zoom is applied around widget center on top of fit-to-window
+    ViewTransform fit = ViewTransform::fit(imageSize, size());
+    double cx = width()/2.0, cy = height()/2.0;
+    view = ViewTransform(cx + (fit.offsetX - cx)*zoom + pan.x(), cy + (fit.offsetY - cy)*zoom + pan.y(),
+                         fit.scaleX*zoom, fit.scaleY*zoom);
+  }
+  else
+    view = ViewTransform();
+
+  viewGeneration++;
+}
+
+void RenderArea::viewChanged()
+{
+  updateViewTransform();
+
+  // show fast version while view changes, smooth one after it stops
+  beginInteraction();
+  rebuildScaledImage(Qt::FastTransformation);
+
+  update();
+}
+
+void RenderArea::endInteraction()
+{
+  // layer drawn in fast mode is redrawn in high quality too
+  interacting = false;
+  invalidateStaticLayer();
+  if (hasImage() && !scaledImageSmooth)
+    rebuildScaledImage(Qt::SmoothTransformation);
+  update();
+}
+
+void RenderArea::zoomAt(QPoint center, double factor)
+{
+  if (!hasImage()) return;
+
+  double baseScale = view.scaleX / zoom;
+  double newZoom = qBound(MIN_ZOOM, zoom*factor, std::max(1.0, MAX_SCALE / baseScale));
+  if (newZoom == zoom) return;
+
+  // keep image point under cursor in place
+  double f = newZoom / zoom;
+  double ox = center.x() - (center.x() - view.offsetX)*f;
+  double oy = center.y() - (center.y() - view.offsetY)*f;
+
+  zoom = newZoom;
+  pan = QPointF(0.0, 0.0);
+  updateViewTransform();
+  pan = QPointF(ox - view.offsetX, oy - view.offsetY);
+
+  viewChanged();
+}
+
+void RenderArea::resetView()
+{
+  zoom = 1.0;
+  pan = QPointF(0.0, 0.0);
+  viewChanged();
+}
+
+void RenderArea::resizeEvent(QResizeEvent *event)
+{
+  QWidget::resizeEvent(event);
+  viewChanged();
+}
+
+void RenderArea::wheelEvent(QWheelEvent *event)
+{
+  double notches = event->angleDelta().y() / 120.0;
+  if (notches == 0.0) return;
+
+  zoomAt(event->pos(), std::pow(ZOOM_STEP, notches));
+  event->accept();
 }
  
 void RenderArea::mousePressEvent(QMouseEvent *event)
 {
-  (void)(event);
-  if (!image) return;
-  if (image->isNull()) return;
+  flushMove();
+  // selection may change
+  invalidateStaticLayer();
+  if (!hasImage()) return;
+  lastMovePos = toImageSpace(event->pos());
+
+  if (event->button() == Qt::MiddleButton)
+  {
+    // start dragging view
+    panning = true;
+    panLastPos = event->pos();
+    return;
+  }
+
   if (tool != ToolType::Polygon && currentShape) return; //already drawing
 
   if (event->buttons() & Qt::LeftButton)
@@ -48,46 +458,62 @@ void RenderArea::mousePressEvent(QMouseEvent *event)
     switch (tool)
     {
       case ToolType::Circle:
-        currentShape = new Shape(ShapeType::Circle, shapeCreationPosition, Vec2(0,0), color);
+        currentShape = store.create(ShapeType::Circle, shapeCreationPosition, Vec2(0,0), color);
         currentShape->vertices.push_back(QPoint(shapeCreationPosition)); // add move anchor
         break;
       case ToolType::Rectangle:
-        currentShape = new Shape(ShapeType::Rectangle, shapeCreationPosition, Vec2(0,0), color);
+        currentShape = store.create(ShapeType::Rectangle, shapeCreationPosition, Vec2(0,0), color);
         currentShape->vertices.push_back(QPoint(shapeCreationPosition)); // add move anchor
         break;
       case ToolType::Polygon:
         if (!currentShape)
         {
           // create new polygon shape if it is not being drawn
-          currentShape = new Shape(ShapeType::Polygon, shapeCreationPosition, color);
+          currentShape = store.create(ShapeType::Polygon, shapeCreationPosition, Vec2(0,0), color);
         } 
 
         break;
       case ToolType::Select:
-        if (selectedShape)
         {
-          auto *s = selectedShape;
-          auto dist = (clickPos - QPoint(s->position.x, s->position.y)).manhattanLength();
-          if (dist <= POLYGON_END_RADIUS)
+          Shape *previous = selectedShape;
+          VertexRef vertex;
+
+          if (selectedShape && (clickPos - QPoint(selectedShape->position.x, selectedShape->position.y))
+                                 .manhattanLength() <= POLYGON_END_RADIUS)
           {
             // selected shape anchor for moving
             selectedOrigin = true;
           } else
+          if ((selectedShape && index.nearestVertex(clickPos, VERTEX_SIZE, vertex, selectedShape)) ||
+              index.nearestVertex(clickPos, VERTEX_SIZE, vertex))
+          {
+            // shape vertex (or anchor for non-polygon shapes), vertices of selected shape go first
+            selectedShape = vertex.shape;
+            selectedVertex = vertex.index;
+            qDebug("Selected vertex %d.\n", vertex.index);
+          } else
+          if (Shape *picked = index.pick(clickPos))
+          {
+            // click inside shape only selects it
+            selectedShape = picked;
+            selectionPicked = true;
+          }
+
+          if (selectedShape != previous)
+          {
+            if (selectedShape && !getStats(selectedShape)) requestStats(selectedShape);
+            update(shapeBounds(previous) | shapeBounds(selectedShape));
+            dynamic_cast<MainWindow*>(myParent)->pickedShape(selectedShape);
+          }
+        }
+        break;
+      case ToolType::Eyedropper:
+        {
+          QColor sampled = sampleColor(clickPos);
+          if (sampled.isValid())
           {
-            for (auto i = 0; i < s->vertices.size(); i++)
-            {
-              const auto &v = s->vertices.at(i);
-              auto vdist = (clickPos - v).manhattanLength();
-              qDebug("%d: %d", i, vdist);
-              if (vdist <= VERTEX_SIZE)
-              {
-                // selected shape vertex (or anchor for non-polygon shapes)
-                selectedVertex = i;
-                qDebug("Selected vertex %d.\n", i);
-                break;
-              }
-
-            }
+            setColor(sampled);
+            emit colorPicked(sampled);
           }
         }
         break;
@@ -97,38 +523,186 @@ void RenderArea::mousePressEvent(QMouseEvent *event)
   }
 }
 
+void RenderArea::leaveEvent(QEvent *event)
+{
+  QWidget::leaveEvent(event);
+  flushMove();
+  hideEyedropper();
+}
+
+QColor RenderArea::sampleColor(QPoint imagePos) const
+{
+  if (!image || image->isNull() || imageSize.isEmpty()) return QColor();
+
+  // full resolution image is read directly, preview only while it is decoded
+  QPoint p = imagePos;
+  if (image->size() != imageSize)
+    p = QPoint((qint64)p.x() * image->width() / imageSize.width(),
+               (qint64)p.y() * image->height() / imageSize.height());
+
+  int r = eyedropperSize/2;
+  QRect kernel = QRect(p - QPoint(r, r), QSize(eyedropperSize, eyedropperSize)) & image->rect();
+  if (kernel.isEmpty()) return QColor();
+
+  // loader hands out 32-bit images only
+  quint32 sr = 0, sg = 0, sb = 0;
+  for (int y = kernel.top(); y <= kernel.bottom(); y++)
+  {
+    const QRgb *line = (const QRgb*)image->constScanLine(y);
+    for (int x = kernel.left(); x <= kernel.right(); x++)
+    {
+      sr += qRed(line[x]);
+      sg += qGreen(line[x]);
+      sb += qBlue(line[x]);
+    }
+  }
+
+  quint32 n = kernel.width() * kernel.height();
+  return QColor((sr + n/2) / n, (sg + n/2) / n, (sb + n/2) / n);
+}
+
+QRect RenderArea::eyedropperKernel()
+{
+  // kernel outline in widget space, covers whole image pixels
+  QPoint p = toImageSpace(eyedropperPos) - QPoint(eyedropperSize/2, eyedropperSize/2);
+  return QRect(view.map(p), view.map(p + QPoint(eyedropperSize, eyedropperSize))).normalized();
+}
+
+QRect RenderArea::eyedropperRect()
+{
+  QRect swatch(eyedropperPos + QPoint(EYEDROPPER_SWATCH/2, EYEDROPPER_SWATCH/2),
+               QSize(EYEDROPPER_SWATCH, EYEDROPPER_SWATCH));
+  return (swatch | eyedropperKernel()).adjusted(-BOUNDS_MARGIN, -BOUNDS_MARGIN, BOUNDS_MARGIN, BOUNDS_MARGIN);
+}
+
+void RenderArea::drawEyedropper(QPainter &painter)
+{
+  painter.setBrush(Qt::NoBrush);
+  painter.setPen(Qt::white);
+  painter.drawRect(eyedropperKernel());
+
+  QRect swatch(eyedropperPos + QPoint(EYEDROPPER_SWATCH/2, EYEDROPPER_SWATCH/2),
+               QSize(EYEDROPPER_SWATCH - 1, EYEDROPPER_SWATCH - 1));
+  painter.setPen(Qt::black);
+  painter.setBrush(eyedropperColor);
+  painter.drawRect(swatch);
+  painter.setBrush(Qt::transparent);
+}
+
+int RenderArea::frameInterval()
+{
+  QWindow *window = this->window()->windowHandle();
+  QScreen *screen = window ? window->screen() : QGuiApplication::primaryScreen();
+  qreal rate = screen ? screen->refreshRate() : 0.0;
+  return rate > 1.0 ? qRound(1000.0 / rate) : FRAME_INTERVAL;
+}
+
 void RenderArea::mouseMoveEvent(QMouseEvent *event)
 {
+  // nothing follows cursor
+  if (!panning && tool != ToolType::Eyedropper && !currentShape && !selectedShape) return;
+
+  // high polling rate mice send many moves per frame, only last one counts
+  movePos = event->pos();
+  moveModifiers = event->modifiers();
+  coalescedMoves++;
+  if (movePending) return;
+
+  movePending = true;
+  inputTime = frameClock.nsecsElapsed();
+  qint64 sinceFrame = (inputTime - lastFrameTime) / 1000000;
+  frameTimer->start((int)std::max<qint64>(0, frameInterval() - sinceFrame));
+}
+
+void RenderArea::applyMove()
+{
+  movePending = false;
+  lastFrameTime = frameClock.nsecsElapsed();
+  // latency is reported only for moves which repaint something
+  appliedInputTime = -1;
+  frameMoves = coalescedMoves;
+  coalescedMoves = 0;
+  if (latencyOverlay)
+    update(latencyRect());
+
+  const QPoint pos = movePos;
+  const Qt::KeyboardModifiers modifiers = moveModifiers;
+
+  if (panning)
+  {
+    pan += QPointF(pos - panLastPos);
+    panLastPos = pos;
+    appliedInputTime = inputTime;
+    viewChanged();
+    return;
+  }
+
+  if (tool == ToolType::Eyedropper)
+  {
+    // live preview of color under cursor
+    QRect dirty = eyedropperColor.isValid() ? eyedropperRect() : QRect();
+    eyedropperPos = pos;
+    eyedropperColor = sampleColor(toImageSpace(eyedropperPos));
+    if (eyedropperColor.isValid())
+      dirty |= eyedropperRect();
+    if (!dirty.isEmpty())
+    {
+      appliedInputTime = inputTime;
+      update(dirty);
+    }
+    return;
+  }
+
   if (!currentShape && !selectedShape) return;
   if (tool == ToolType::Polygon) return;
 
   auto startPos = shapeCreationPosition;
-  static auto lastMovePos = toImageSpace(event->pos());
-  auto endPos = toImageSpace(event->pos());
+  auto endPos = toImageSpace(pos);
   auto diff = (endPos - startPos);
-  
-  auto realSize = realImageSize();
-  int iw = realSize.x();
-  int ih = realSize.y();
-  double ratioX = (double)(iw) / (double)(image->width());
-  double ratioY = (double)(ih) / (double)(image->height());
+
+  QRect dirty;
 
   if (tool == ToolType::Select)
   {
+    if (selectedOrigin || selectedVertex >= 0)
+      dirty = shapeBounds(selectedShape);
+
     if (selectedOrigin)
     {
+      QPoint from(selectedShape->position.x, selectedShape->position.y);
       selectedShape->position.x = endPos.x();
       selectedShape->position.y = endPos.y();
       auto mdiff = (endPos - lastMovePos);
+      index.removeVertices(selectedShape);
       for (auto i = 0; i < selectedShape->vertices.size(); i++)
       {
         selectedShape->vertices.replace(i, selectedShape->vertices.at(i) + mdiff);
       }
+      index.insertVertices(selectedShape);
+
+      // only offsets are recorded, vertices are never copied
+      Command move(CommandType::MoveOrigin, selectedShape->id);
+      move.delta = endPos - from;
+      move.verticesDelta = mdiff;
+      move.open = true;
+      if (!move.delta.isNull() || !move.verticesDelta.isNull())
+        record(std::move(move));
     } else
     if (selectedVertex >= 0)
     {
+      // polygon vertices snap to vertices of other shapes unless shift is held
+      if (selectedShape->type == ShapeType::Polygon && !(modifiers & Qt::ShiftModifier))
+        endPos = index.snap(endPos, SNAP_RADIUS, selectedShape);
+
       //qDebug("Moving vertex %d to %d;%d", selectedVertex, endPos.x(), endPos.y());
+      QPoint from = selectedShape->vertices.at(selectedVertex);
       selectedShape->vertices.replace(selectedVertex, endPos);
+      index.moveVertex(selectedShape, selectedVertex, from, endPos);
+
+      Command move(CommandType::MoveVertex, selectedShape->id);
+      move.vertex = selectedVertex;
+      move.delta = endPos - from;
+      move.open = true;
 
       // change size based on some shapes
       if (selectedShape->type != ShapeType::Polygon)
@@ -136,7 +710,20 @@ void RenderArea::mouseMoveEvent(QMouseEvent *event)
         auto vdiff = (endPos - lastMovePos);
         selectedShape->size.x += vdiff.x()*2;
         selectedShape->size.y += vdiff.y()*2;
+        move.sizeDelta = vdiff*2;
       }
+
+      if (!move.delta.isNull() || !move.sizeDelta.isNull())
+        record(std::move(move));
+    }
+
+    if (selectedOrigin || selectedVertex >= 0)
+    {
+      beginInteraction();
+      dirty |= refreshBounds(selectedShape);
+      index.updateBounds(selectedShape, selectedShape->imageBounds);
+      dragChanged = true;
+      emit shapeModified(selectedShape);
     }
   }
 
@@ -145,6 +732,8 @@ void RenderArea::mouseMoveEvent(QMouseEvent *event)
 
   if (currentShape)
   {
+    beginInteraction();
+    dirty |= shapeBounds(currentShape);
     currentShape->size = size*2; 
 
     // always place extra vertex for some shapes
@@ -152,19 +741,36 @@ void RenderArea::mouseMoveEvent(QMouseEvent *event)
     {
       currentShape->vertices.replace(0, endPos);
     }
+    dirty |= refreshBounds(currentShape);
   }
 
-  repaint();
+  if (!dirty.isEmpty())
+  {
+    appliedInputTime = inputTime;
+    update(dirty);
+  }
 
-  lastMovePos = toImageSpace(event->pos());
+  lastMovePos = toImageSpace(pos);
 }
 
 void RenderArea::mouseReleaseEvent(QMouseEvent *event)
 {
+  flushMove();
+
+  if (event->button() == Qt::MiddleButton)
+  {
+    panning = false;
+    return;
+  }
+
   if (tool == ToolType::NONE) return;
 
+  QRect dirty;
+
   if (currentShape)
   {
+    dirty = shapeBounds(currentShape);
+
     auto startPos = shapeCreationPosition;
     auto endPos = toImageSpace(event->pos());
 
@@ -187,8 +793,11 @@ void RenderArea::mouseReleaseEvent(QMouseEvent *event)
           shapeCreationPosition = toImageSpace(event->pos());
         }
         polygonEnd = false;
-        // place new vertex
-        currentShape->vertices.push_back(toImageSpace(event->pos()));
+        // place new vertex, snapped to vertices of other shapes unless shift is held
+        QPoint vertexPos = toImageSpace(event->pos());
+        if (!(event->modifiers() & Qt::ShiftModifier))
+          vertexPos = index.snap(vertexPos, SNAP_RADIUS, currentShape);
+        currentShape->vertices.push_back(vertexPos);
       } else
       {
         // creation is ended when click is outside radius
@@ -198,37 +807,63 @@ void RenderArea::mouseReleaseEvent(QMouseEvent *event)
       qDebug("Current shape vertices: %d\n", currentShape->vertices.size());
     }
 
+    Shape *shape = currentShape;
+    bool committed = false;
+
     if (polygonEnd)
     {
       // if mouse didn't move during mouse move
       if (dist > 1 || (tool == ToolType::Polygon))
       {
-        // add shape to rendering list
-        this->shapes.push_back(currentShape);
-        qDebug("New shape is added. List: %zu elements.\n", shapes.size());
-        // add shape to shapes list
-        dynamic_cast<MainWindow*>(myParent)->addedShape(currentShape);
+        committed = true;
       } else
       {
         // if shape is too small delete it
-        delete currentShape;
+        store.destroy(currentShape);
+        shape = nullptr;
       }
 
       currentShape = nullptr;
     } 
 
+    // bounds change when shape stops being drawn (no creation anchor)
+    dirty |= refreshBounds(shape);
+    if (committed)
+    {
+      // add shape to rendering list and shapes list
+      insertShape(shape, (int)shapes.size());
+      qDebug("New shape is added. List: %zu elements.\n", shapes.size());
+      Command create(CommandType::Create, shape->id);
+      create.row = (int)shapes.size() - 1;
+      record(std::move(create));
+      requestStats(shape);
+    }
+
   }
 
-  // if we did not moved vertex or shape origin
-  if (selectedVertex < 0 && !selectedOrigin)
+  // if we did not moved vertex or shape origin nor picked shape
+  if (selectedVertex < 0 && !selectedOrigin && !selectionPicked && selectedShape)
   {
-    // unselect shape
+    // unselect shape, list selection follows like on pick
+    dirty |= shapeBounds(selectedShape);
     selectedShape = nullptr;
+    dynamic_cast<MainWindow*>(myParent)->pickedShape(nullptr);
   }
+  // stats follow finished drag, not every move of it
+  if (dragChanged && selectedShape)
+    requestStats(selectedShape);
+  dragChanged = false;
   selectedVertex = -1;
   selectedOrigin = false;
+  selectionPicked = false;
+  // layer is needed again only by next drag
+  if (!currentShape) staticLayer = QPixmap();
+  invalidateStaticLayer();
+  // drag is one undo step
+  history.seal();
 
-  repaint();
+  if (!dirty.isEmpty())
+    update(dirty);
 }
 
 void RenderArea::paintEvent(QPaintEvent *event)
@@ -242,19 +877,229 @@ void RenderArea::paintEvent(QPaintEvent *event)
 
   QPainter painter(this);
 
-  int w = width();
-  int h = height();
+  if (!scaledImageValid())
+    rebuildScaledImage(interacting ? Qt::FastTransformation : Qt::SmoothTransformation);
+  painter.setRenderHint(QPainter::Antialiasing, !interacting);
 
-  QImage img = image->scaled(w, h, Qt::KeepAspectRatio);
-  int iw = img.width();
-  int ih = img.height();
-  painter.drawImage(w/2 - iw/2, h/2 - ih/2,img);
+  const QRect &dirty = event->rect();
 
-  for (const auto &shape : shapes)
+  // while shape is dragged or drawn everything else is one blit of cached layer
+  Shape *active = (selectedOrigin || selectedVertex >= 0) ? selectedShape : nullptr;
+  if (active || currentShape)
   {
-    drawShape(shape, painter);
+    const qreal dpr = devicePixelRatioF();
+    if (!staticLayerValid || staticLayerActive != active || staticLayerView != viewGeneration
+        || staticLayer.size() != size() * dpr)
+      rebuildStaticLayer(active);
+    painter.drawPixmap(QRectF(dirty), staticLayer, QRectF(QPointF(dirty.topLeft()) * dpr, QSizeF(dirty.size()) * dpr));
+    if (shapeBounds(active).intersects(dirty))
+    {
+      // dragged shape changes every frame so its outline is simplified again
+      prepareOutline(active);
+      drawShape(active, painter);
+    }
   }
-  drawShape(currentShape, painter);
+  else
+    drawScene(painter, dirty, nullptr);
+
+  if (shapeBounds(currentShape).intersects(dirty))
+    drawShape(currentShape, painter);
+
+  if (tool == ToolType::Eyedropper && eyedropperColor.isValid() && eyedropperRect().intersects(dirty))
+    drawEyedropper(painter);
+
+  if (appliedInputTime >= 0)
+  {
+    double latency = (frameClock.nsecsElapsed() - appliedInputTime) / 1e6;
+    appliedInputTime = -1;
+    latencyAverage += (latency - latencyAverage) * LATENCY_SMOOTHING;
+    latencyMax = std::max(latencyMax, latency);
+  }
+  if (latencyOverlay && latencyRect().intersects(dirty))
+    drawLatency(painter);
+}
+
+void RenderArea::drawScene(QPainter &painter, const QRect &dirty, Shape *skip)
+{
+  // blit only the part of background that needs repainting
+  QRect target = scaledImageRect & dirty;
+  if (!target.isEmpty())
+    painter.drawPixmap(target, scaledImage, target.translated(-scaledImageRect.topLeft()));
+
+  // skip shapes outside of visible part of image, unless most of image is
+  // visible candidates come from grid index and are put back in list order
+  QRect visible = visibleImageRect(dirty);
+  std::vector<Shape*> candidates;
+  const std::vector<Shape*> *source = &shapes;
+  if ((qint64)visible.width() * visible.height() * 2 < (qint64)imageSize.width() * imageSize.height())
+  {
+    index.query(visible, candidates);
+    std::sort(candidates.begin(), candidates.end(), [](const Shape *a, const Shape *b) { return a->row < b->row; });
+    source = &candidates;
+  }
+
+  std::vector<Shape*> visibleShapes;
+  for (const auto shape : *source)
+  {
+    if (shape == skip || !shapeImageBounds(shape).intersects(visible)) continue;
+    // outlines are simplified here, drawShape only reads them
+    prepareOutline(shape);
+    visibleShapes.push_back(shape);
+  }
+
+  // small updates (drags, selection) are cheaper without threads
+  if (visibleShapes.size() < RENDER_TILE_MIN_SHAPES
+      || (qint64)dirty.width() * dirty.height() <= (qint64)RENDER_TILE_SIZE * RENDER_TILE_SIZE)
+  {
+    for (const auto shape : visibleShapes)
+      drawShape(shape, painter);
+    return;
+  }
+  drawTiled(painter, dirty, visibleShapes);
+}
+
+/*
+ * Shapes are binned in drawing order into screen tiles, every tile is
+ * painted into own image on pool threads and images are composited here.
+ * drawShape only reads shapes, view and outlines prepared in drawScene.
+ */
+void RenderArea::drawTiled(QPainter &painter, const QRect &dirty, const std::vector<Shape*> &visibleShapes)
+{
+  struct Tile
+  {
+    QRect rect;
+    std::vector<Shape*> shapes;
+    QImage image;
+  };
+
+  const int cols = (dirty.width() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  const int rows = (dirty.height() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  std::vector<Tile> tiles(cols * rows);
+  for (int r = 0; r < rows; r++)
+    for (int c = 0; c < cols; c++)
+      tiles[r*cols + c].rect = QRect(dirty.x() + c*RENDER_TILE_SIZE, dirty.y() + r*RENDER_TILE_SIZE,
+                                     RENDER_TILE_SIZE, RENDER_TILE_SIZE) & dirty;
+
+  for (const auto shape : visibleShapes)
+  {
+    QRect b = shapeBounds(shape) & dirty;
+    if (b.isEmpty()) continue;
+    const int c0 = (b.left() - dirty.x()) / RENDER_TILE_SIZE, c1 = (b.right() - dirty.x()) / RENDER_TILE_SIZE;
+    const int r0 = (b.top() - dirty.y()) / RENDER_TILE_SIZE, r1 = (b.bottom() - dirty.y()) / RENDER_TILE_SIZE;
+    for (int r = r0; r <= r1; r++)
+      for (int c = c0; c <= c1; c++)
+        tiles[r*cols + c].shapes.push_back(shape);
+  }
+
+  const qreal dpr = painter.device()->devicePixelRatioF();
+  const bool antialiasing = painter.testRenderHint(QPainter::Antialiasing);
+  QtConcurrent::blockingMap(tiles, [this, dpr, antialiasing](Tile &tile)
+  {
+    if (tile.shapes.empty()) return;
+
+    tile.image = QImage(tile.rect.size() * dpr, QImage::Format_ARGB32_Premultiplied);
+    tile.image.setDevicePixelRatio(dpr);
+    tile.image.fill(Qt::transparent);
+
+    QPainter tilePainter(&tile.image);
+    tilePainter.setRenderHint(QPainter::Antialiasing, antialiasing);
+    tilePainter.translate(-tile.rect.topLeft());
+    for (const auto shape : tile.shapes)
+      drawShape(shape, tilePainter);
+  });
+
+  for (const auto &tile : tiles)
+  {
+    if (!tile.image.isNull())
+      painter.drawImage(tile.rect.topLeft(), tile.image);
+  }
+}
+
+void RenderArea::rebuildStaticLayer(Shape *active)
+{
+  // device pixels, so layer is as sharp as shapes painted directly
+  const qreal dpr = devicePixelRatioF();
+  staticLayer = QPixmap(size() * dpr);
+  staticLayer.setDevicePixelRatio(dpr);
+  staticLayer.fill(Qt::transparent);
+
+  QPainter painter(&staticLayer);
+  painter.setRenderHint(QPainter::Antialiasing, !interacting);
+  drawScene(painter, rect(), active);
+
+  staticLayerActive = active;
+  staticLayerView = viewGeneration;
+  staticLayerValid = true;
+}
+
+QRect RenderArea::latencyRect()
+{
+  return QRect(0, 0, fontMetrics().averageCharWidth()*36, fontMetrics().height()*2 + 8);
+}
+
+void RenderArea::drawLatency(QPainter &painter)
+{
+  // values of previous frame, this one is still being painted
+  QRect r = latencyRect();
+  painter.setPen(Qt::NoPen);
+  painter.setBrush(QColor(0, 0, 0, 160));
+  painter.drawRect(r);
+  painter.setPen(Qt::white);
+  painter.drawText(r.adjusted(4, 4, -4, -4), Qt::AlignLeft | Qt::AlignTop,
+                   tr("input to paint %1 ms (max %2 ms)\n%3 ms frames, %4 moves per frame")
+                     .arg(latencyAverage, 0, 'f', 1).arg(latencyMax, 0, 'f', 1)
+                     .arg(frameInterval()).arg(frameMoves));
+  painter.setBrush(Qt::transparent);
+}
+
+QRect RenderArea::computeImageBounds(Shape *shape)
+{
+  // handles are drawn with constant size in image space
+  QPoint pos(shape->position.x, shape->position.y);
+  QPoint size(shape->size.x, shape->size.y);
+
+  auto around = [](QPoint p, int radius)
+  {
+    return QRect(p - QPoint(radius, radius), p + QPoint(radius, radius));
+  };
+
+  // anchor point
+  int anchorRadius = POLYGON_END_RADIUS/2 + 1;
+  QRect r = around(pos, anchorRadius);
+  if (currentShape == shape)
+    r |= around(shapeCreationPosition, anchorRadius);
+
+  switch (shape->type)
+  {
+    case ShapeType::Circle:
+      r |= QRect(pos.x()-size.x()/2, pos.y()-size.y()/2, size.x(), size.y()).normalized();
+      break;
+    case ShapeType::Rectangle:
+      r |= QRect(pos.x(), pos.y(), size.x()/2, size.y()/2).normalized();
+      break;
+    default:
+      break;
+  }
+
+  // vertices with their selection handles
+  if (!shape->vertices.isEmpty())
+  {
+    const QPoint *v = shape->vertices.constData();
+    int minX = v[0].x(), minY = v[0].y(), maxX = minX, maxY = minY;
+    for (int i = 1; i < shape->vertices.size(); i++)
+    {
+      minX = std::min(minX, v[i].x());
+      minY = std::min(minY, v[i].y());
+      maxX = std::max(maxX, v[i].x());
+      maxY = std::max(maxY, v[i].y());
+    }
+
+    int vertexRadius = VERTEX_SIZE/2 + 1;
+    r |= QRect(QPoint(minX, minY), QPoint(maxX, maxY))
+           .adjusted(-vertexRadius, -vertexRadius, vertexRadius, vertexRadius);
+  }
+
+  return r;
 }
 
 void RenderArea::drawShape(Shape *shape, QPainter &painter)
@@ -262,12 +1107,9 @@ void RenderArea::drawShape(Shape *shape, QPainter &painter)
   if (!shape) return;
 
   QPoint pos = toWidgetSpace(shape->position.x, shape->position.y);
-  
-  auto realSize = realImageSize();
-  int iw = realSize.x();
-  int ih = realSize.y();
-  double ratioX = (double)(iw) / (double)(image->width());
-  double ratioY = (double)(ih) / (double)(image->height());
+
+  double ratioX = view.scaleX;
+  double ratioY = view.scaleY;
   auto size = QPoint(shape->size.x * ratioX ,
                      shape->size.y * ratioY);
   
@@ -308,10 +1150,11 @@ void RenderArea::drawShape(Shape *shape, QPainter &painter)
         }
 
         painter.setBrush(Qt::black);
-        for (const auto &p : shape->vertices)
+        auto psize = VERTEX_SIZE*ratioX;
+        QVector<QPoint> handles(shape->vertices.size());
+        view.mapPoints(shape->vertices.constData(), handles.data(), handles.size());
+        for (const auto &ppos : handles)
         {
-          auto ppos = toWidgetSpace(p.x(), p.y());
-          auto psize = VERTEX_SIZE*ratioX;
           painter.drawEllipse(ppos.x()-psize/2, ppos.y()-psize/2, psize, psize);
         }
         painter.setBrush(Qt::transparent);
@@ -331,10 +1174,14 @@ void RenderArea::drawShape(Shape *shape, QPainter &painter)
       break;
     case ShapeType::Polygon:
       {
-        QVector<QPoint> points;
-        for (const auto &p : shape->vertices){
-          points.push_back(toWidgetSpace(p));
-        }
+        // committed outlines are drawn with detail matching view scale
+        int count = shape->vertices.size();
+        const QPoint *source = shape->vertices.constData();
+        if (currentShape != shape)
+          source = lod.cached(shape, outlineScale(), count);
+
+        QVector<QPoint> points(count);
+        view.mapPoints(source, points.data(), count);
         if (currentShape == shape)
           painter.drawPolyline(points); // incomplete polygon
         else
@@ -346,42 +1193,3 @@ void RenderArea::drawShape(Shape *shape, QPainter &painter)
       qDebug("Shape %d. not supported!\n", shape->type);
   }
 }
-  
-QPoint RenderArea::toWidgetSpace(QPoint point)
-{
-  int px = point.x();
-  int py = point.y();
-
-  int w = width(), h = height();
-
-  auto realSize = realImageSize();
-  int iw = realSize.x();
-  int ih = realSize.y();
-
-  double ratioX = (double)(iw) / (double)(image->width());
-  double ratioY = (double)(ih) / (double)(image->height());
-
-  int sx = w/2 - iw/2 + px*ratioX;
-  int sy = h/2 - ih/2 + py*ratioY;
-
-  return QPoint(sx, sy);
-}
-
-QPoint RenderArea::toImageSpace(QPoint point)
-{
-  int mx = point.x(), my = point.y();
-  double imageRatio = (double)image->width() / (double)image->height();
-
-  int w = width(), h = height();
-  auto realSize = realImageSize();
-  int iw = realSize.x();
-  int ih = realSize.y();
-
-  int ox = w/2 - iw/2, oy = h/2 - ih/2;
-  mx -= ox; my -= oy;
-
-  mx *= (double)(image->width()) / (double)(iw);
-  my *= (double)(image->height()) / (double)(ih);
-
-  return QPoint(mx, my);
-}
@@ -0,0 +1,160 @@
+#include "shape.hpp"
+
+#include <algorithm>
+
+VertexArena::~VertexArena()
+{
+  for (auto chunk : chunks)
+    delete[] chunk;
+}
+
+int VertexArena::sizeClass(int capacity)
+{
+  int c = 0;
+  for (int n = VERTEX_MIN_CAPACITY; n < capacity; n *= 2)
+    c++;
+  return c;
+}
+
+QPoint *VertexArena::allocate(int capacity)
+{
+  // blocks bigger than chunk are not pooled
+  if (capacity > VERTEX_CHUNK_SIZE) return new QPoint[capacity];
+
+  size_t c = (size_t)sizeClass(capacity);
+  if (c < freeBlocks.size() && !freeBlocks[c].empty())
+  {
+    QPoint *block = freeBlocks[c].back();
+    freeBlocks[c].pop_back();
+    return block;
+  }
+
+  if (chunkLeft < capacity)
+  {
+    // rest of current chunk is split into smaller free blocks
+    for (int n = VERTEX_CHUNK_SIZE; n >= VERTEX_MIN_CAPACITY; n /= 2)
+    {
+      while (chunkLeft >= n)
+      {
+        release(chunkPos, n);
+        chunkPos += n;
+        chunkLeft -= n;
+      }
+    }
+
+    chunks.push_back(new QPoint[VERTEX_CHUNK_SIZE]);
+    chunkPos = chunks.back();
+    chunkLeft = VERTEX_CHUNK_SIZE;
+  }
+
+  QPoint *block = chunkPos;
+  chunkPos += capacity;
+  chunkLeft -= capacity;
+  return block;
+}
+
+void VertexArena::release(QPoint *block, int capacity)
+{
+  if (!block) return;
+  if (capacity > VERTEX_CHUNK_SIZE)
+  {
+    delete[] block;
+    return;
+  }
+
+  size_t c = (size_t)sizeClass(capacity);
+  if (freeBlocks.size() <= c) freeBlocks.resize(c + 1);
+  freeBlocks[c].push_back(block);
+}
+
+VertexArray::VertexArray(const VertexArray &other)
+{
+  assign(other.points, other.count);
+}
+
+VertexArray::VertexArray(VertexArray &&other)
+  : arena{other.arena}, points{other.points}, count{other.count}, capacity{other.capacity}
+{
+  other.points = nullptr;
+  other.count = 0;
+  other.capacity = 0;
+}
+
+VertexArray::~VertexArray()
+{
+  clear();
+}
+
+VertexArray &VertexArray::operator=(const VertexArray &other)
+{
+  if (this != &other) assign(other.points, other.count);
+  return *this;
+}
+
+VertexArray &VertexArray::operator=(VertexArray &&other)
+{
+  if (this == &other) return *this;
+  if (arena != other.arena)
+  {
+    // storage of different pools can not be exchanged
+    assign(other.points, other.count);
+    return *this;
+  }
+
+  clear();
+  std::swap(points, other.points);
+  std::swap(count, other.count);
+  std::swap(capacity, other.capacity);
+  return *this;
+}
+
+void VertexArray::assign(const QPoint *src, int n)
+{
+  count = 0;
+  if (n > capacity) reallocate(n);
+  std::copy(src, src + n, points);
+  count = n;
+}
+
+void VertexArray::reallocate(int minCapacity)
+{
+  int newCapacity = VERTEX_MIN_CAPACITY;
+  while (newCapacity < minCapacity)
+    newCapacity *= 2;
+
+  QPoint *block = arena ? arena->allocate(newCapacity) : new QPoint[newCapacity];
+  std::copy(points, points + count, block);
+
+  if (arena)
+    arena->release(points, capacity);
+  else
+    delete[] points;
+
+  points = block;
+  capacity = newCapacity;
+}
+
+void VertexArray::resize(int n)
+{
+  if (n > capacity) reallocate(n);
+  for (int i = count; i < n; i++)
+    points[i] = QPoint();
+  count = n;
+}
+
+void VertexArray::reserve(int n)
+{
+  if (n > capacity) reallocate(n);
+}
+
+void VertexArray::clear()
+{
+  if (arena)
+    arena->release(points, capacity);
+  else
+    delete[] points;
+
+  points = nullptr;
+  count = 0;
+  capacity = 0;
+}
@@ -0,0 +1,246 @@
+#include "shapeindex.hpp"
+#include "renderarea.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// even-odd test straight on vertex array, no QPolygon copy
+static bool polygonContains(const VertexArray &vertices, const QPoint &p)
+{
+  bool inside = false;
+  const int n = vertices.size();
+  for (int i = 0, j = n - 1; i < n; j = i++)
+  {
+    const QPoint &a = vertices.at(i), &b = vertices.at(j);
+    if ((a.y() > p.y()) != (b.y() > p.y()) &&
+        p.x() < a.x() + (double)(b.x() - a.x()) * (p.y() - a.y()) / (b.y() - a.y()))
+      inside = !inside;
+  }
+  return inside;
+}
+
+void ShapeIndex::clear()
+{
+  shapeCells.clear();
+  vertexCells.clear();
+  shapeRanges.clear();
+}
+
+void ShapeIndex::addCells(Shape *shape, const QRect &range)
+{
+  for (int cy = range.top(); cy <= range.bottom(); cy++)
+    for (int cx = range.left(); cx <= range.right(); cx++)
+      shapeCells[cellKey(cx, cy)].push_back(shape);
+}
+
+void ShapeIndex::removeCells(Shape *shape, const QRect &range)
+{
+  for (int cy = range.top(); cy <= range.bottom(); cy++)
+  {
+    for (int cx = range.left(); cx <= range.right(); cx++)
+    {
+      auto it = shapeCells.find(cellKey(cx, cy));
+      if (it == shapeCells.end()) continue;
+      it->removeOne(shape);
+      if (it->isEmpty()) shapeCells.erase(it);
+    }
+  }
+}
+
+void ShapeIndex::insert(Shape *shape, const QRect &bounds)
+{
+  QRect range = cellRange(bounds);
+  shapeRanges.insert(shape, range);
+  addCells(shape, range);
+  insertVertices(shape);
+}
+
+void ShapeIndex::remove(Shape *shape)
+{
+  auto it = shapeRanges.find(shape);
+  if (it == shapeRanges.end()) return;
+
+  removeCells(shape, *it);
+  shapeRanges.erase(it);
+  removeVertices(shape);
+}
+
+void ShapeIndex::updateBounds(Shape *shape, const QRect &bounds)
+{
+  auto it = shapeRanges.find(shape);
+  if (it == shapeRanges.end()) return;
+
+  QRect range = cellRange(bounds);
+  if (range == *it) return;
+
+  removeCells(shape, *it);
+  addCells(shape, range);
+  *it = range;
+}
+
+void ShapeIndex::insertVertices(Shape *shape)
+{
+  for (int i = 0; i < shape->vertices.size(); i++)
+  {
+    const QPoint &v = shape->vertices.at(i);
+    vertexCells[cellKey(cellOf(v.x()), cellOf(v.y()))].push_back(VertexRef{shape, i});
+  }
+}
+
+void ShapeIndex::removeVertices(Shape *shape)
+{
+  for (const auto &v : shape->vertices)
+  {
+    auto it = vertexCells.find(cellKey(cellOf(v.x()), cellOf(v.y())));
+    if (it == vertexCells.end()) continue;
+
+    auto &refs = *it;
+    refs.erase(std::remove_if(refs.begin(), refs.end(), [shape](const VertexRef &r) { return r.shape == shape; }),
+               refs.end());
+    if (refs.isEmpty()) vertexCells.erase(it);
+  }
+}
+
+void ShapeIndex::moveVertex(Shape *shape, int index, const QPoint &from, const QPoint &to)
+{
+  quint64 fromKey = cellKey(cellOf(from.x()), cellOf(from.y()));
+  quint64 toKey = cellKey(cellOf(to.x()), cellOf(to.y()));
+  if (fromKey == toKey) return;
+
+  auto it = vertexCells.find(fromKey);
+  if (it != vertexCells.end())
+  {
+    auto &refs = *it;
+    for (int i = 0; i < refs.size(); i++)
+    {
+      if (refs[i].shape == shape && refs[i].index == index)
+      {
+        refs.remove(i);
+        break;
+      }
+    }
+    if (refs.isEmpty()) vertexCells.erase(it);
+  }
+  vertexCells[toKey].push_back(VertexRef{shape, index});
+}
+
+void ShapeIndex::query(const QRect &rect, std::vector<Shape*> &result) const
+{
+  size_t first = result.size();
+  QRect range = cellRange(rect);
+  for (int cy = range.top(); cy <= range.bottom(); cy++)
+  {
+    for (int cx = range.left(); cx <= range.right(); cx++)
+    {
+      auto it = shapeCells.constFind(cellKey(cx, cy));
+      if (it == shapeCells.constEnd()) continue;
+      result.insert(result.end(), it->begin(), it->end());
+    }
+  }
+
+  // shapes spanning many cells are found more than once
+  std::sort(result.begin() + first, result.end());
+  result.erase(std::unique(result.begin() + first, result.end()), result.end());
+}
+
+bool ShapeIndex::contains(const Shape *shape, const QPoint &p)
+{
+  QPoint pos(shape->position.x, shape->position.y);
+  QPoint size(shape->size.x, shape->size.y);
+
+  switch (shape->type)
+  {
+    case ShapeType::Circle:
+      {
+        double rx = std::abs(size.x()) / 2.0, ry = std::abs(size.y()) / 2.0;
+        if (rx <= 0.0 || ry <= 0.0) return false;
+        double dx = (p.x() - pos.x()) / rx, dy = (p.y() - pos.y()) / ry;
+        return dx*dx + dy*dy <= 1.0;
+      }
+    case ShapeType::Rectangle:
+      return QRect(pos.x(), pos.y(), size.x()/2, size.y()/2).normalized().contains(p);
+    case ShapeType::Polygon:
+      return polygonContains(shape->vertices, p);
+    default:
+      return false;
+  }
+}
+
+Shape *ShapeIndex::pick(const QPoint &p) const
+{
+  auto it = shapeCells.constFind(cellKey(cellOf(p.x()), cellOf(p.y())));
+  if (it == shapeCells.constEnd()) return nullptr;
+
+  // prefer most specific (smallest) shape when shapes overlap
+  Shape *best = nullptr;
+  qint64 bestArea = LLONG_MAX;
+  for (Shape *shape : *it)
+  {
+    if (!shape->imageBounds.contains(p) || !contains(shape, p)) continue;
+
+    qint64 area = (qint64)shape->imageBounds.width() * shape->imageBounds.height();
+    if (area < bestArea)
+    {
+      best = shape;
+      bestArea = area;
+    }
+  }
+  return best;
+}
+
+bool ShapeIndex::nearestVertex(const QPoint &p, int radius, VertexRef &result, const Shape *only) const
+{
+  int bestDist = INT_MAX;
+  QRect range = cellRange(QRect(p - QPoint(radius, radius), p + QPoint(radius, radius)));
+  for (int cy = range.top(); cy <= range.bottom(); cy++)
+  {
+    for (int cx = range.left(); cx <= range.right(); cx++)
+    {
+      auto it = vertexCells.constFind(cellKey(cx, cy));
+      if (it == vertexCells.constEnd()) continue;
+
+      for (const auto &ref : *it)
+      {
+        if (only && ref.shape != only) continue;
+
+        int dist = (p - ref.shape->vertices.at(ref.index)).manhattanLength();
+        if (dist <= radius && dist < bestDist)
+        {
+          bestDist = dist;
+          result = ref;
+        }
+      }
+    }
+  }
+  return bestDist != INT_MAX;
+}
+
+QPoint ShapeIndex::snap(const QPoint &p, int radius, const Shape *ignore) const
+{
+  int bestDist = INT_MAX;
+  QPoint best = p;
+  QRect range = cellRange(QRect(p - QPoint(radius, radius), p + QPoint(radius, radius)));
+  for (int cy = range.top(); cy <= range.bottom(); cy++)
+  {
+    for (int cx = range.left(); cx <= range.right(); cx++)
+    {
+      auto it = vertexCells.constFind(cellKey(cx, cy));
+      if (it == vertexCells.constEnd()) continue;
+
+      for (const auto &ref : *it)
+      {
+        if (ref.shape == ignore) continue;
+
+        const QPoint &v = ref.shape->vertices.at(ref.index);
+        int dist = (p - v).manhattanLength();
+        if (dist <= radius && dist < bestDist)
+        {
+          bestDist = dist;
+          best = v;
+        }
+      }
+    }
+  }
+  return best;
+}
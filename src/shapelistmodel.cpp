@@ -0,0 +1,158 @@
+#include "shapelistmodel.hpp"
+#include "renderarea.hpp"
+#include "regionstats.hpp"
+
+#include <QColor>
+#include <QImage>
+#include <QPixmap>
+
+#include <map>
+
+static const std::map<ShapeType, QString> shapeNames = {
+  { ShapeType::Polygon, "Polygon" },
+  { ShapeType::Circle, "Circle" },
+  { ShapeType::Rectangle, "Rectangle" }
+};
+
+ShapeListModel::ShapeListModel(QObject *parent) : QAbstractListModel(parent)
+{
+}
+
+void ShapeListModel::setArea(RenderArea *area)
+{
+  beginResetModel();
+  this->area = area;
+  icons.clear();
+  endResetModel();
+}
+
+int ShapeListModel::rowCount(const QModelIndex &parent) const
+{
+  if (parent.isValid() || !area) return 0;
+  return (int)area->getShapes().size();
+}
+
+Shape *ShapeListModel::shapeAt(int row) const
+{
+  if (!area || row < 0 || row >= rowCount()) return nullptr;
+  return area->getShapes()[row];
+}
+
+int ShapeListModel::rowOf(Shape *shape) const
+{
+  return area ? area->rowOf(shape) : -1;
+}
+
+QVariant ShapeListModel::data(const QModelIndex &index, int role) const
+{
+  Shape *shape = shapeAt(index.row());
+  if (!shape) return QVariant();
+
+  const RegionStats *stats = area->getStats(shape);
+  // loaded shapes get statistics once their row is shown
+  if (!stats && role == Qt::DisplayRole) area->requestStats(shape);
+  if (stats && stats->isEmpty()) stats = nullptr;
+
+  auto name = shapeNames.find(shape->type);
+  QString text = name != shapeNames.end() ? name->second : QString("Shape");
+
+  switch (role)
+  {
+    case Qt::DisplayRole:
+      {
+        if (!stats) return text;
+        QColor mean(qRound(stats->mean[0]), qRound(stats->mean[1]), qRound(stats->mean[2]));
+        return QString("%1  %2  %3 px").arg(text).arg(mean.name()).arg(stats->count);
+      }
+    case Qt::ToolTipRole:
+      {
+        if (!stats) return QVariant();
+        const QRect &b = stats->bounds;
+        return QString("Pixels: %1\nBounds: %2,%3 %4x%5\nMean: %6, %7, %8\nMedian: %9, %10, %11")
+                 .arg(stats->count).arg(b.x()).arg(b.y()).arg(b.width()).arg(b.height())
+                 .arg(stats->mean[0], 0, 'f', 1).arg(stats->mean[1], 0, 'f', 1).arg(stats->mean[2], 0, 'f', 1)
+                 .arg(stats->median[0]).arg(stats->median[1]).arg(stats->median[2]);
+      }
+    case Qt::DecorationRole:
+      {
+        if (!stats) return QVariant();
+        // built only for rows that are painted
+        auto icon = icons.find(shape);
+        if (icon == icons.end())
+          icon = icons.insert(shape, histogramIcon(*stats));
+        return *icon;
+      }
+    default:
+      return QVariant();
+  }
+}
+
+void ShapeListModel::beginInsertShape(int row)
+{
+  beginInsertRows(QModelIndex(), row, row);
+}
+
+void ShapeListModel::endInsertShape()
+{
+  endInsertRows();
+}
+
+void ShapeListModel::beginRemoveShape(int row)
+{
+  icons.remove(shapeAt(row));
+  beginRemoveRows(QModelIndex(), row, row);
+}
+
+void ShapeListModel::endRemoveShape()
+{
+  endRemoveRows();
+}
+
+void ShapeListModel::beginBulkLoad()
+{
+  beginResetModel();
+}
+
+void ShapeListModel::endBulkLoad()
+{
+  icons.clear();
+  endResetModel();
+}
+
+void ShapeListModel::statsChanged(Shape *shape)
+{
+  int row = rowOf(shape);
+  if (row < 0) return;
+
+  icons.remove(shape);
+  QModelIndex i = index(row);
+  emit dataChanged(i, i, {Qt::DisplayRole, Qt::ToolTipRole, Qt::DecorationRole});
+}
+
+QIcon ShapeListModel::histogramIcon(const RegionStats &stats)
+{
+  // channel histograms added on top of each other, columns scaled to highest bin
+  const int size = HISTOGRAM_ICON_SIZE;
+  quint32 highest = 1;
+  for (const auto &h : stats.histogram)
+    highest = std::max(highest, *std::max_element(h.begin(), h.end()));
+
+  QImage icon(size, size, QImage::Format_RGB32);
+  icon.fill(Qt::black);
+  const int binsPerColumn = 256 / size;
+  for (int c = 0; c < 3; c++)
+  {
+    QRgb channel = qRgb(c == 0 ? 255 : 0, c == 1 ? 255 : 0, c == 2 ? 255 : 0);
+    for (int x = 0; x < size; x++)
+    {
+      quint32 bin = 0;
+      for (int i = 0; i < binsPerColumn; i++)
+        bin = std::max(bin, stats.histogram[c][x*binsPerColumn + i]);
+
+      int h = (int)((quint64)bin * size / highest);
+      for (int y = size - h; y < size; y++)
+        icon.setPixel(x, y, icon.pixel(x, y) | channel);
+    }
+  }
+  return QIcon(QPixmap::fromImage(icon));
+}
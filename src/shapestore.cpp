@@ -0,0 +1,92 @@
+#include "shapestore.hpp"
+
+#include <algorithm>
+
+ShapeStore::ShapeStore() : arena{new VertexArena()}
+{
+}
+
+ShapeStore::~ShapeStore()
+{
+  blocks.clear();
+}
+
+ShapeStore::ShapeStore(ShapeStore &&other)
+  : blocks{std::move(other.blocks)}, freeSlots{std::move(other.freeSlots)},
+    arena{std::move(other.arena)}, ids{std::move(other.ids)}, nextId{other.nextId}
+{
+  // moved-from store stays usable
+  other.arena.reset(new VertexArena());
+  other.ids.clear();
+  other.nextId = 1;
+}
+
+ShapeStore &ShapeStore::operator=(ShapeStore &&other)
+{
+  if (this == &other) return *this;
+
+  blocks = std::move(other.blocks);
+  freeSlots = std::move(other.freeSlots);
+  arena = std::move(other.arena);
+  ids = std::move(other.ids);
+  nextId = other.nextId;
+
+  other.blocks.clear();
+  other.freeSlots.clear();
+  other.arena.reset(new VertexArena());
+  other.ids.clear();
+  other.nextId = 1;
+  return *this;
+}
+
+Shape *ShapeStore::create(quint32 id)
+{
+  if (freeSlots.empty())
+  {
+    blocks.emplace_back(new Shape[SHAPE_BLOCK_SIZE]);
+    Shape *block = blocks.back().get();
+    // slots are handed out in address order
+    for (int i = SHAPE_BLOCK_SIZE - 1; i >= 0; i--)
+      freeSlots.push_back(block + i);
+  }
+
+  if (id == 0 || ids.contains(id))
+    id = nextId;
+  nextId = std::max(nextId, id + 1);
+
+  Shape *shape = freeSlots.back();
+  freeSlots.pop_back();
+  shape->vertices.reset(arena.get());
+  shape->id = id;
+  ids.insert(id, shape);
+  return shape;
+}
+
+Shape *ShapeStore::create(ShapeType type, Vec2 position, Vec2 size, Color color)
+{
+  Shape *shape = create();
+  shape->type = type;
+  shape->position = position;
+  shape->size = size;
+  shape->color = color;
+  return shape;
+}
+
+void ShapeStore::destroy(Shape *shape)
+{
+  if (!shape || ids.value(shape->id) != shape) return;
+
+  ids.remove(shape->id);
+  // vertex block goes back to arena, slot to free list
+  shape->vertices.clear();
+  *shape = Shape();
+  freeSlots.push_back(shape);
+}
+
+void ShapeStore::clear()
+{
+  blocks.clear();
+  freeSlots.clear();
+  ids.clear();
+  arena.reset(new VertexArena());
+}